@@ -0,0 +1,343 @@
+/*
+  Toccata LV2 plugin
+
+  Copyright 2020, Paul Ferrand <paul@ferrand.cc>
+
+  Permission to use, copy, modify, and/or distribute this software for any
+  purpose with or without fee is hereby granted, provided that the above
+  copyright notice and this permission notice appear in all copies.
+
+  THIS SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include "dsp.h"
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define TOCCATA_SSE 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define TOCCATA_NEON 1
+#endif
+
+// Vector parts of the kernels, for a multiple of 4 frames
+static inline void
+mix_vectors(float* output, const float* input, float gain, int num_frames)
+{
+#if defined(TOCCATA_SSE)
+    const __m128 gains = _mm_set1_ps(gain);
+    for (int i = 0; i < num_frames; i += 4) {
+        const __m128 mixed = _mm_add_ps(_mm_loadu_ps(output + i), _mm_mul_ps(gains, _mm_loadu_ps(input + i)));
+        _mm_storeu_ps(output + i, mixed);
+    }
+#elif defined(TOCCATA_NEON)
+    const float32x4_t gains = vdupq_n_f32(gain);
+    for (int i = 0; i < num_frames; i += 4)
+        vst1q_f32(output + i, vmlaq_f32(vld1q_f32(output + i), gains, vld1q_f32(input + i)));
+#else
+    for (int i = 0; i < num_frames; ++i)
+        output[i] += gain * input[i];
+#endif
+}
+
+static inline void
+mix_ramp_vectors(float* output, const float* input, float gain, float step, int num_frames)
+{
+    // The gains are computed from the frame index rather than accumulated,
+    // so that long ramps end exactly where they should
+#if defined(TOCCATA_SSE)
+    const __m128 offsets = _mm_mul_ps(_mm_set1_ps(step), _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f));
+    for (int i = 0; i < num_frames; i += 4) {
+        const __m128 gains = _mm_add_ps(_mm_set1_ps(gain + (float)i * step), offsets);
+        const __m128 mixed = _mm_add_ps(_mm_loadu_ps(output + i), _mm_mul_ps(gains, _mm_loadu_ps(input + i)));
+        _mm_storeu_ps(output + i, mixed);
+    }
+#elif defined(TOCCATA_NEON)
+    const float indices[4] = { 0.0f, 1.0f, 2.0f, 3.0f };
+    const float32x4_t offsets = vmulq_n_f32(vld1q_f32(indices), step);
+    for (int i = 0; i < num_frames; i += 4) {
+        const float32x4_t gains = vaddq_f32(vdupq_n_f32(gain + (float)i * step), offsets);
+        vst1q_f32(output + i, vmlaq_f32(vld1q_f32(output + i), gains, vld1q_f32(input + i)));
+    }
+#else
+    for (int i = 0; i < num_frames; ++i)
+        output[i] += (gain + (float)i * step) * input[i];
+#endif
+}
+
+static inline void
+scale_ramp_vectors(float* buffer, float gain, float step, int num_frames)
+{
+#if defined(TOCCATA_SSE)
+    const __m128 offsets = _mm_mul_ps(_mm_set1_ps(step), _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f));
+    for (int i = 0; i < num_frames; i += 4) {
+        const __m128 gains = _mm_add_ps(_mm_set1_ps(gain + (float)i * step), offsets);
+        _mm_storeu_ps(buffer + i, _mm_mul_ps(gains, _mm_loadu_ps(buffer + i)));
+    }
+#elif defined(TOCCATA_NEON)
+    const float indices[4] = { 0.0f, 1.0f, 2.0f, 3.0f };
+    const float32x4_t offsets = vmulq_n_f32(vld1q_f32(indices), step);
+    for (int i = 0; i < num_frames; i += 4) {
+        const float32x4_t gains = vaddq_f32(vdupq_n_f32(gain + (float)i * step), offsets);
+        vst1q_f32(buffer + i, vmulq_f32(gains, vld1q_f32(buffer + i)));
+    }
+#else
+    for (int i = 0; i < num_frames; ++i)
+        buffer[i] *= gain + (float)i * step;
+#endif
+}
+
+static inline void
+lowpass_vectors(float* buffer, float pole, float* state, int num_frames)
+{
+#if defined(TOCCATA_SSE) || defined(TOCCATA_NEON)
+    // Four outputs at once from the last one: output j is the last one
+    // times pole^(j + 1), plus input m <= j times (1 - pole) * pole^(j - m)
+    float powers[5] = { 1.0f };
+    for (int j = 1; j < 5; ++j)
+        powers[j] = powers[j - 1] * pole;
+    float weights[4][4];
+    for (int m = 0; m < 4; ++m) {
+        for (int j = 0; j < 4; ++j)
+            weights[m][j] = j >= m ? (1.0f - pole) * powers[j - m] : 0.0f;
+    }
+    float last = *state;
+#if defined(TOCCATA_SSE)
+    const __m128 feedback = _mm_loadu_ps(powers + 1);
+    const __m128 w0 = _mm_loadu_ps(weights[0]);
+    const __m128 w1 = _mm_loadu_ps(weights[1]);
+    const __m128 w2 = _mm_loadu_ps(weights[2]);
+    const __m128 w3 = _mm_loadu_ps(weights[3]);
+    for (int i = 0; i < num_frames; i += 4) {
+        __m128 filtered = _mm_mul_ps(feedback, _mm_set1_ps(last));
+        filtered = _mm_add_ps(filtered, _mm_mul_ps(w0, _mm_set1_ps(buffer[i])));
+        filtered = _mm_add_ps(filtered, _mm_mul_ps(w1, _mm_set1_ps(buffer[i + 1])));
+        filtered = _mm_add_ps(filtered, _mm_mul_ps(w2, _mm_set1_ps(buffer[i + 2])));
+        filtered = _mm_add_ps(filtered, _mm_mul_ps(w3, _mm_set1_ps(buffer[i + 3])));
+        _mm_storeu_ps(buffer + i, filtered);
+        last = buffer[i + 3];
+    }
+#else
+    const float32x4_t feedback = vld1q_f32(powers + 1);
+    const float32x4_t w0 = vld1q_f32(weights[0]);
+    const float32x4_t w1 = vld1q_f32(weights[1]);
+    const float32x4_t w2 = vld1q_f32(weights[2]);
+    const float32x4_t w3 = vld1q_f32(weights[3]);
+    for (int i = 0; i < num_frames; i += 4) {
+        float32x4_t filtered = vmulq_n_f32(feedback, last);
+        filtered = vmlaq_n_f32(filtered, w0, buffer[i]);
+        filtered = vmlaq_n_f32(filtered, w1, buffer[i + 1]);
+        filtered = vmlaq_n_f32(filtered, w2, buffer[i + 2]);
+        filtered = vmlaq_n_f32(filtered, w3, buffer[i + 3]);
+        vst1q_f32(buffer + i, filtered);
+        last = vgetq_lane_f32(filtered, 3);
+    }
+#endif
+    *state = last;
+#else
+    float last = *state;
+    for (int i = 0; i < num_frames; ++i) {
+        last = (1.0f - pole) * buffer[i] + pole * last;
+        buffer[i] = last;
+    }
+    *state = last;
+#endif
+}
+
+static inline float
+dot_vectors(const float* a, const float* b, int size)
+{
+#if defined(TOCCATA_SSE)
+    __m128 sums = _mm_setzero_ps();
+    for (int i = 0; i < size; i += 4)
+        sums = _mm_add_ps(sums, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+    sums = _mm_add_ps(sums, _mm_movehl_ps(sums, sums));
+    sums = _mm_add_ss(sums, _mm_shuffle_ps(sums, sums, 1));
+    return _mm_cvtss_f32(sums);
+#elif defined(TOCCATA_NEON)
+    float32x4_t sums = vdupq_n_f32(0.0f);
+    for (int i = 0; i < size; i += 4)
+        sums = vmlaq_f32(sums, vld1q_f32(a + i), vld1q_f32(b + i));
+    const float32x2_t pairs = vadd_f32(vget_low_f32(sums), vget_high_f32(sums));
+    return vget_lane_f32(vpadd_f32(pairs, pairs), 0);
+#else
+    float sum = 0.0f;
+    for (int i = 0; i < size; ++i)
+        sum += a[i] * b[i];
+    return sum;
+#endif
+}
+
+static inline void
+complex_multiply_add_vectors(float* real, float* imag, const float* a_real, const float* a_imag,
+    const float* b_real, const float* b_imag, int size)
+{
+#if defined(TOCCATA_SSE)
+    for (int i = 0; i < size; i += 4) {
+        const __m128 ar = _mm_loadu_ps(a_real + i);
+        const __m128 ai = _mm_loadu_ps(a_imag + i);
+        const __m128 br = _mm_loadu_ps(b_real + i);
+        const __m128 bi = _mm_loadu_ps(b_imag + i);
+        const __m128 r = _mm_sub_ps(_mm_mul_ps(ar, br), _mm_mul_ps(ai, bi));
+        const __m128 j = _mm_add_ps(_mm_mul_ps(ar, bi), _mm_mul_ps(ai, br));
+        _mm_storeu_ps(real + i, _mm_add_ps(_mm_loadu_ps(real + i), r));
+        _mm_storeu_ps(imag + i, _mm_add_ps(_mm_loadu_ps(imag + i), j));
+    }
+#elif defined(TOCCATA_NEON)
+    for (int i = 0; i < size; i += 4) {
+        const float32x4_t ar = vld1q_f32(a_real + i);
+        const float32x4_t ai = vld1q_f32(a_imag + i);
+        const float32x4_t br = vld1q_f32(b_real + i);
+        const float32x4_t bi = vld1q_f32(b_imag + i);
+        vst1q_f32(real + i, vmlsq_f32(vmlaq_f32(vld1q_f32(real + i), ar, br), ai, bi));
+        vst1q_f32(imag + i, vmlaq_f32(vmlaq_f32(vld1q_f32(imag + i), ar, bi), ai, br));
+    }
+#else
+    for (int i = 0; i < size; ++i) {
+        real[i] += a_real[i] * b_real[i] - a_imag[i] * b_imag[i];
+        imag[i] += a_real[i] * b_imag[i] + a_imag[i] * b_real[i];
+    }
+#endif
+}
+
+void
+toccata_mix(float* output, const float* input, float gain, int num_frames)
+{
+    const int num_vector_frames = num_frames & ~3;
+    mix_vectors(output, input, gain, num_vector_frames);
+    for (int i = num_vector_frames; i < num_frames; ++i)
+        output[i] += gain * input[i];
+}
+
+void
+toccata_mix_ramp(float* output, const float* input, float gain, float step, int num_frames)
+{
+    const int num_vector_frames = num_frames & ~3;
+    mix_ramp_vectors(output, input, gain, step, num_vector_frames);
+    for (int i = num_vector_frames; i < num_frames; ++i)
+        output[i] += (gain + (float)i * step) * input[i];
+}
+
+void
+toccata_scale_ramp(float* buffer, float gain, float step, int num_frames)
+{
+    const int num_vector_frames = num_frames & ~3;
+    scale_ramp_vectors(buffer, gain, step, num_vector_frames);
+    for (int i = num_vector_frames; i < num_frames; ++i)
+        buffer[i] *= gain + (float)i * step;
+}
+
+void
+toccata_lowpass(float* buffer, float pole, float* state, int num_frames)
+{
+    const int num_vector_frames = num_frames & ~3;
+    lowpass_vectors(buffer, pole, state, num_vector_frames);
+    float last = *state;
+    for (int i = num_vector_frames; i < num_frames; ++i) {
+        last = (1.0f - pole) * buffer[i] + pole * last;
+        buffer[i] = last;
+    }
+    *state = last;
+}
+
+float
+toccata_dot(const float* a, const float* b, int size)
+{
+    const int num_vector_elements = size & ~3;
+    float sum = dot_vectors(a, b, num_vector_elements);
+    for (int i = num_vector_elements; i < size; ++i)
+        sum += a[i] * b[i];
+    return sum;
+}
+
+void
+toccata_complex_multiply_add(float* real, float* imag, const float* a_real, const float* a_imag,
+    const float* b_real, const float* b_imag, int size)
+{
+    const int num_vector_elements = size & ~3;
+    complex_multiply_add_vectors(real, imag, a_real, a_imag, b_real, b_imag, num_vector_elements);
+    for (int i = num_vector_elements; i < size; ++i) {
+        real[i] += a_real[i] * b_real[i] - a_imag[i] * b_imag[i];
+        imag[i] += a_real[i] * b_imag[i] + a_imag[i] * b_real[i];
+    }
+}
+
+// The frame count of these is a constant multiple of 4, so they have no
+// remainder loop and the compiler is free to unroll them
+#define FIXED_BLOCK_KERNELS(N)                                                                   \
+    static void                                                                                  \
+    mix_##N(float* output, const float* input, float gain, int num_frames)                       \
+    {                                                                                            \
+        (void)num_frames;                                                                        \
+        mix_vectors(output, input, gain, N);                                                     \
+    }                                                                                            \
+    static void                                                                                  \
+    mix_ramp_##N(float* output, const float* input, float gain, float step, int num_frames)      \
+    {                                                                                            \
+        (void)num_frames;                                                                        \
+        mix_ramp_vectors(output, input, gain, step, N);                                          \
+    }
+
+FIXED_BLOCK_KERNELS(64)
+FIXED_BLOCK_KERNELS(128)
+FIXED_BLOCK_KERNELS(256)
+
+toccata_mix_function_t
+toccata_get_mix(int block_size)
+{
+    switch (block_size) {
+    case 64:
+        return mix_64;
+    case 128:
+        return mix_128;
+    case 256:
+        return mix_256;
+    default:
+        return toccata_mix;
+    }
+}
+
+toccata_mix_ramp_function_t
+toccata_get_mix_ramp(int block_size)
+{
+    switch (block_size) {
+    case 64:
+        return mix_ramp_64;
+    case 128:
+        return mix_ramp_128;
+    case 256:
+        return mix_ramp_256;
+    default:
+        return toccata_mix_ramp;
+    }
+}
+
+// Odd taps of a 63-tap Kaiser-windowed halfband, from the center outwards;
+// the center tap is 0.5 and the other even taps are 0
+static const float halfband[16] = {
+    3.170728721e-01f, -1.024425088e-01f, 5.772404439e-02f, -3.748938157e-02f,
+    2.563768528e-02f, -1.780470021e-02f, 1.231558303e-02f, -8.376210429e-03f,
+    5.543647017e-03f, -3.534414302e-03f, 2.145908571e-03f, -1.222076003e-03f,
+    6.381063754e-04f, -2.935600810e-04f, 1.090362306e-04f, -2.401525244e-05f
+};
+
+void
+toccata_decimate(float* output, const float* input, int num_frames)
+{
+    // Polyphase: the center tap reads the even input frames, and the
+    // symmetric pairs the odd ones around it. The filter is linear phase,
+    // so output frame i is centered on input frame 2 * (i - DELAY)
+    for (int i = 0; i < num_frames; ++i) {
+        const float* center = input + 2 * (i - TOCCATA_DECIMATOR_DELAY);
+        float sum = 0.5f * center[0];
+        for (int j = 0; j < 16; ++j)
+            sum += halfband[j] * (center[-2 * j - 1] + center[2 * j + 1]);
+        output[i] = sum;
+    }
+}
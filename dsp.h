@@ -0,0 +1,84 @@
+/*
+  Toccata LV2 plugin
+
+  Copyright 2020, Paul Ferrand <paul@ferrand.cc>
+
+  Permission to use, copy, modify, and/or distribute this software for any
+  purpose with or without fee is hereby granted, provided that the above
+  copyright notice and this permission notice appear in all copies.
+
+  THIS SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#ifndef TOCCATA_DSP_H
+#define TOCCATA_DSP_H
+
+/**
+   Add `input` scaled by `gain` to `output`.
+*/
+void toccata_mix(float* output, const float* input, float gain, int num_frames);
+
+/**
+   Add `input` scaled by a linear ramp to `output`: frame `i` is scaled by
+   `gain + i * step`.
+*/
+void toccata_mix_ramp(float* output, const float* input, float gain, float step, int num_frames);
+
+/**
+   Scale `buffer` in place by a linear ramp: frame `i` is scaled by
+   `gain + i * step`.
+*/
+void toccata_scale_ramp(float* buffer, float gain, float step, int num_frames);
+
+/**
+   Filter `buffer` in place through the one-pole lowpass
+   `y[i] = (1 - pole) * x[i] + pole * y[i - 1]`. `state` holds the last
+   output, and is updated for the next call.
+*/
+void toccata_lowpass(float* buffer, float pole, float* state, int num_frames);
+
+/**
+   Sum of the products of `a` and `b`.
+*/
+float toccata_dot(const float* a, const float* b, int size);
+
+/**
+   Add the products of the complex arrays `a` and `b`, on split real and
+   imaginary parts, to `real` and `imag`.
+*/
+void toccata_complex_multiply_add(float* real, float* imag, const float* a_real, const float* a_imag,
+    const float* b_real, const float* b_imag, int size);
+
+typedef void (*toccata_mix_function_t)(float* output, const float* input, float gain, int num_frames);
+typedef void (*toccata_mix_ramp_function_t)(float* output, const float* input, float gain, float step, int num_frames);
+
+/**
+   Get kernels specialized for blocks of exactly `block_size` frames, which
+   ignore their `num_frames`. There are some for 64, 128 and 256 frames;
+   other sizes get toccata_mix() and toccata_mix_ramp().
+*/
+toccata_mix_function_t toccata_get_mix(int block_size);
+toccata_mix_ramp_function_t toccata_get_mix_ramp(int block_size);
+
+/**
+   Input frames that must precede the input of toccata_decimate(), and
+   the delay of its filter in output frames.
+*/
+#define TOCCATA_DECIMATOR_HISTORY 62
+#define TOCCATA_DECIMATOR_DELAY 15
+
+/**
+   Write `num_frames` frames to `output` from `2 * num_frames` frames of
+   `input` at twice the rate, through a halfband lowpass that passes up to
+   0.2 and stops from 0.29 of the input rate. The last
+   TOCCATA_DECIMATOR_HISTORY frames before `input` must be valid.
+*/
+void toccata_decimate(float* output, const float* input, int num_frames);
+
+#endif // TOCCATA_DSP_H
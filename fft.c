@@ -0,0 +1,104 @@
+/*
+  Toccata LV2 plugin
+
+  Copyright 2020, Paul Ferrand <paul@ferrand.cc>
+
+  Permission to use, copy, modify, and/or distribute this software for any
+  purpose with or without fee is hereby granted, provided that the above
+  copyright notice and this permission notice appear in all copies.
+
+  THIS SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include "fft.h"
+
+#include <math.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+// Transforms up to this size keep their split parts in the L1 cache
+#define IN_CACHE_SIZE 2048
+
+static inline void
+butterfly(double* real, double* imag, int i, int j, double w_real, double w_imag)
+{
+    const double t_real = real[j] * w_real - imag[j] * w_imag;
+    const double t_imag = real[j] * w_imag + imag[j] * w_real;
+    real[j] = real[i] - t_real;
+    imag[j] = imag[i] - t_imag;
+    real[i] += t_real;
+    imag[i] += t_imag;
+}
+
+static inline void
+rotate(double* w_real, double* w_imag, double step_real, double step_imag)
+{
+    const double next_real = *w_real * step_real - *w_imag * step_imag;
+    *w_imag = *w_real * step_imag + *w_imag * step_real;
+    *w_real = next_real;
+}
+
+void
+toccata_fft(double* real, double* imag, int size, bool inverse)
+{
+    // Bit-reversal permutation
+    for (int i = 1, j = 0; i < size; ++i) {
+        int bit = size >> 1;
+        for (; j & bit; bit >>= 1)
+            j ^= bit;
+        j ^= bit;
+
+        if (i < j) {
+            double tmp = real[i];
+            real[i] = real[j];
+            real[j] = tmp;
+            tmp = imag[i];
+            imag[i] = imag[j];
+            imag[j] = tmp;
+        }
+    }
+
+    // Radix-2 butterflies
+    for (int length = 2; length <= size; length <<= 1) {
+        const double angle = (inverse ? 2.0 : -2.0) * M_PI / length;
+        const double step_real = cos(angle);
+        const double step_imag = sin(angle);
+        const int half = length / 2;
+        if (size <= IN_CACHE_SIZE) {
+            double w_real = 1.0;
+            double w_imag = 0.0;
+            for (int k = 0; k < half; ++k) {
+                for (int i = k; i < size; i += length)
+                    butterfly(real, imag, i, i + half, w_real, w_imag);
+                rotate(&w_real, &w_imag, step_real, step_imag);
+            }
+        } else {
+            // Group by group, so that large transforms go through memory in
+            // order; every group runs the same twiddle recurrence
+            for (int start = 0; start < size; start += length) {
+                double w_real = 1.0;
+                double w_imag = 0.0;
+                for (int k = 0; k < half; ++k) {
+                    butterfly(real, imag, start + k, start + k + half, w_real, w_imag);
+                    rotate(&w_real, &w_imag, step_real, step_imag);
+                }
+            }
+        }
+    }
+
+    if (inverse) {
+        const double scale = 1.0 / size;
+        for (int i = 0; i < size; ++i) {
+            real[i] *= scale;
+            imag[i] *= scale;
+        }
+    }
+}
@@ -0,0 +1,30 @@
+/*
+  Toccata LV2 plugin
+
+  Copyright 2020, Paul Ferrand <paul@ferrand.cc>
+
+  Permission to use, copy, modify, and/or distribute this software for any
+  purpose with or without fee is hereby granted, provided that the above
+  copyright notice and this permission notice appear in all copies.
+
+  THIS SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#ifndef TOCCATA_FFT_H
+#define TOCCATA_FFT_H
+
+#include <stdbool.h>
+
+/**
+   In-place complex FFT on split real and imaginary parts.
+   `size` must be a power of two. The inverse transform is scaled by 1/size.
+*/
+void toccata_fft(double* real, double* imag, int size, bool inverse);
+
+#endif // TOCCATA_FFT_H
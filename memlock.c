@@ -0,0 +1,85 @@
+/*
+  Toccata LV2 plugin
+
+  Copyright 2020, Paul Ferrand <paul@ferrand.cc>
+
+  Permission to use, copy, modify, and/or distribute this software for any
+  purpose with or without fee is hereby granted, provided that the above
+  copyright notice and this permission notice appear in all copies.
+
+  THIS SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include "memlock.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <sys/resource.h>
+#define TOCCATA_HAVE_MLOCK 1
+#endif
+
+#define MEMORY_PAGE_SIZE 4096
+
+void
+toccata_prefault(void* data, size_t size)
+{
+    // Rewrite one byte per page so that even copy-on-write pages get mapped
+    volatile char* bytes = (volatile char*)data;
+    for (size_t i = 0; i < size; i += MEMORY_PAGE_SIZE)
+        bytes[i] = bytes[i];
+}
+
+bool
+toccata_lock(void* data, size_t size)
+{
+    if (!data || size == 0)
+        return true;
+
+    toccata_prefault(data, size);
+#ifdef TOCCATA_HAVE_MLOCK
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_MEMLOCK, &limit) == 0
+        && limit.rlim_cur != RLIM_INFINITY && size > limit.rlim_cur)
+        return false;
+
+    return mlock(data, size) == 0;
+#else
+    return false;
+#endif
+}
+
+void
+toccata_unlock(void* data, size_t size)
+{
+    if (!data || size == 0)
+        return;
+
+#ifdef TOCCATA_HAVE_MLOCK
+    munlock(data, size);
+#endif
+}
+
+bool
+toccata_lock_buffer(void* data, size_t size, bool* locked)
+{
+    if (!data || size == 0)
+        return true;
+
+    if (!*locked)
+        *locked = toccata_lock(data, size);
+    return *locked;
+}
+
+void
+toccata_unlock_buffer(void* data, size_t size, bool* locked)
+{
+    if (*locked)
+        toccata_unlock(data, size);
+    *locked = false;
+}
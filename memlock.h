@@ -0,0 +1,56 @@
+/*
+  Toccata LV2 plugin
+
+  Copyright 2020, Paul Ferrand <paul@ferrand.cc>
+
+  Permission to use, copy, modify, and/or distribute this software for any
+  purpose with or without fee is hereby granted, provided that the above
+  copyright notice and this permission notice appear in all copies.
+
+  THIS SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#ifndef TOCCATA_MEMLOCK_H
+#define TOCCATA_MEMLOCK_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/**
+   Touch every page of a buffer so that it is mapped before the audio
+   thread uses it. The contents are left untouched.
+*/
+void toccata_prefault(void* data, size_t size);
+
+/**
+   Pre-fault a buffer and try to lock it in memory. Returns false when the
+   buffer could only be pre-faulted, e.g. because RLIMIT_MEMLOCK is too low
+   or the platform has no mlock().
+*/
+bool toccata_lock(void* data, size_t size);
+
+/**
+   Unlock a buffer previously locked with toccata_lock().
+*/
+void toccata_unlock(void* data, size_t size);
+
+/**
+   Lock a buffer with toccata_lock(), unless it is already locked, and
+   record in `locked` whether mlock() took it. Returns false when the
+   buffer could only be pre-faulted.
+*/
+bool toccata_lock_buffer(void* data, size_t size, bool* locked);
+
+/**
+   Unlock a buffer only if toccata_lock_buffer() managed to lock it, so
+   that pages it shares with other locked buffers stay locked otherwise.
+*/
+void toccata_unlock_buffer(void* data, size_t size, bool* locked);
+
+#endif // TOCCATA_MEMLOCK_H
@@ -0,0 +1,120 @@
+/*
+  Toccata LV2 plugin
+
+  Copyright 2020, Paul Ferrand <paul@ferrand.cc>
+
+  Permission to use, copy, modify, and/or distribute this software for any
+  purpose with or without fee is hereby granted, provided that the above
+  copyright notice and this permission notice appear in all copies.
+
+  THIS SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include "organ.h"
+
+// Tables are named after the C that starts their octave
+const int toccata_table_octaves[TOCCATA_TABLES_PER_RANK] = { 2, 3, 4, 5, 6 };
+
+const toccata_rank_t toccata_ranks[TOCCATA_NUM_RANKS] = {
+    {
+        .symbol = "bourdon16",
+        .name = "Bourdon 16",
+        .tables = "bourdon16",
+        .cc = 100,
+        .group = TOCCATA_GROUP_FLUES,
+        .layout = TOCCATA_LAYOUT_SIDES,
+        .transpose = -12,
+    },
+    {
+        .symbol = "flute8",
+        .name = "Flute 8",
+        .tables = "flute8",
+        .cc = 101,
+        .group = TOCCATA_GROUP_FLUES,
+        .layout = TOCCATA_LAYOUT_SIDES,
+        .transpose = 0,
+    },
+    {
+        .symbol = "montre8",
+        .name = "Montre 8",
+        .tables = "montre8",
+        .cc = 102,
+        .group = TOCCATA_GROUP_FLUES,
+        .layout = TOCCATA_LAYOUT_SIDES,
+        .transpose = 0,
+    },
+    {
+        .symbol = "flute4",
+        .name = "Flute à fuseaux 4",
+        .tables = "flutefuseau4",
+        .cc = 103,
+        .group = TOCCATA_GROUP_FLUES,
+        .layout = TOCCATA_LAYOUT_SIDES,
+        .transpose = 12,
+    },
+    {
+        .symbol = "prestant4",
+        .name = "Prestant 4",
+        .tables = "prestant4",
+        .cc = 104,
+        .group = TOCCATA_GROUP_FLUES,
+        .layout = TOCCATA_LAYOUT_SIDES,
+        .transpose = 12,
+    },
+    {
+        .symbol = "doublette2",
+        .name = "Doublette 2",
+        .tables = "doublette2",
+        .cc = 105,
+        .group = TOCCATA_GROUP_FLUES,
+        .layout = TOCCATA_LAYOUT_SIDES,
+        .transpose = 24,
+    },
+    {
+        .symbol = "pleinjeux",
+        .name = "Plein jeux 4R",
+        .tables = "pleinjeux4R",
+        .cc = 106,
+        .group = TOCCATA_GROUP_REEDS,
+        .layout = TOCCATA_LAYOUT_SIDES,
+        .transpose = 12,
+    },
+    {
+        .symbol = "sesquialtera",
+        .name = "Sesquialtera 2R",
+        .tables = "sesquialtera2R",
+        .cc = 107,
+        .group = TOCCATA_GROUP_REEDS,
+        .layout = TOCCATA_LAYOUT_SIDES,
+        .transpose = 0,
+    },
+    {
+        .symbol = "trompette8",
+        .name = "Trompette 8",
+        .tables = "trompette8",
+        .cc = 108,
+        .group = TOCCATA_GROUP_REEDS,
+        .layout = TOCCATA_LAYOUT_CENTER,
+        .transpose = 0,
+    },
+};
+
+// The Sesquialtera is a solo color, so it stays out of the crescendo
+const float toccata_crescendo[TOCCATA_CRESCENDO_STEPS][TOCCATA_NUM_RANKS] = {
+    // Bourdon 16, Flute 8, Montre 8, Flute 4, Prestant 4, Doublette 2, Plein jeux, Sesquialtera, Trompette 8
+    { 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f },
+    { 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f },
+    { 0.0f, 1.0f, 0.0f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f },
+    { 0.0f, 1.0f, 1.0f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f },
+    { 1.0f, 1.0f, 1.0f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f },
+    { 1.0f, 1.0f, 1.0f, 1.0f, 1.0f, 0.0f, 0.0f, 0.0f, 0.0f },
+    { 1.0f, 1.0f, 1.0f, 1.0f, 1.0f, 1.0f, 0.0f, 0.0f, 0.0f },
+    { 1.0f, 1.0f, 1.0f, 1.0f, 1.0f, 1.0f, 1.0f, 0.0f, 0.0f },
+    { 1.0f, 1.0f, 1.0f, 1.0f, 1.0f, 1.0f, 1.0f, 0.0f, 1.0f },
+};
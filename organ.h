@@ -0,0 +1,116 @@
+/*
+  Toccata LV2 plugin
+
+  Copyright 2020, Paul Ferrand <paul@ferrand.cc>
+
+  Permission to use, copy, modify, and/or distribute this software for any
+  purpose with or without fee is hereby granted, provided that the above
+  copyright notice and this permission notice appear in all copies.
+
+  THIS SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#ifndef TOCCATA_ORGAN_H
+#define TOCCATA_ORGAN_H
+
+/**
+   Native description of the organ.
+
+   Every rank has the same five octave tables, so only what differs
+   between ranks is listed here. Adding a rank means adding its tables to
+   instrument/, an entry to `toccata_ranks` and its voicing.
+
+   The key ranges, crossfades and envelopes are not compiled in: they are
+   read from instrument/voicing.txt when the organ is built (see voicing.h).
+   The SFZ files of instrument/ are for other players, the plugin does not
+   read them.
+*/
+
+#define TOCCATA_NUM_RANKS 9
+#define TOCCATA_TABLES_PER_RANK 5
+#define TOCCATA_LOWEST_KEY 36 // C2
+#define TOCCATA_HIGHEST_KEY 96 // C7
+#define TOCCATA_NUM_KEYS (TOCCATA_HIGHEST_KEY - TOCCATA_LOWEST_KEY + 1)
+#define TOCCATA_VOLUME_DB -9.0f
+#define TOCCATA_RELEASE_TIME 0.1f
+#define TOCCATA_DEFAULT_ATTACK_TIME 0.02f
+#define TOCCATA_CRESCENDO_STEPS 9
+
+/**
+   Groups of ranks, which the host can take on outputs of their own.
+*/
+enum {
+    TOCCATA_GROUP_FLUES = 0,
+    TOCCATA_GROUP_REEDS, ///< Reeds and mixtures
+    TOCCATA_NUM_GROUPS
+};
+
+/**
+   Placement of the pipes of a rank across the case, which gives the pan of
+   each key.
+*/
+enum {
+    TOCCATA_LAYOUT_CENTER = 0, ///< All pipes in the middle
+    TOCCATA_LAYOUT_SIDES, ///< C and C# sides, the largest pipes outside
+    TOCCATA_NUM_LAYOUTS
+};
+
+/**
+   Divisions of the console, each played from its own MIDI channel. Every
+   division can draw any rank as a stop of its own.
+*/
+enum {
+    TOCCATA_DIVISION_GREAT = 0,
+    TOCCATA_DIVISION_POSITIVE,
+    TOCCATA_DIVISION_PEDAL,
+    TOCCATA_NUM_DIVISIONS
+};
+
+/// Division behind the shutters of the swell box
+#define TOCCATA_ENCLOSED_DIVISION TOCCATA_DIVISION_POSITIVE
+
+#define TOCCATA_NUM_STOPS (TOCCATA_NUM_DIVISIONS * TOCCATA_NUM_RANKS)
+#define TOCCATA_STOP(division, rank) ((division) * TOCCATA_NUM_RANKS + (rank))
+
+/**
+   Key range and crossfades of an octave table, shared by all ranks.
+   A crossfade range of 0-0 means no crossfade on that side.
+*/
+typedef struct {
+    int octave; ///< Table files are named `table_<rank>_c<octave>_sustain.wav`
+    int lokey;
+    int hikey;
+    int xfin_lokey;
+    int xfin_hikey;
+    int xfout_lokey;
+    int xfout_hikey;
+} toccata_table_zone_t;
+
+typedef struct {
+    const char* symbol; ///< Symbol of the stop port
+    const char* name;
+    const char* tables; ///< Rank part of the table file names
+    int cc; ///< MIDI CC drawing the stop
+    int group; ///< Whose outputs the rank can be sent to
+    int layout; ///< Placement of the pipes
+    int transpose; ///< In semitones
+} toccata_rank_t;
+
+/// Octave of each table, which names its files
+extern const int toccata_table_octaves[TOCCATA_TABLES_PER_RANK];
+extern const toccata_rank_t toccata_ranks[TOCCATA_NUM_RANKS];
+
+/**
+   Registration of each step of the crescendo pedal, from none to the full
+   organ, as a gain per rank. Each step adds to the stops drawn on every
+   division.
+*/
+extern const float toccata_crescendo[TOCCATA_CRESCENDO_STEPS][TOCCATA_NUM_RANKS];
+
+#endif // TOCCATA_ORGAN_H
@@ -0,0 +1,344 @@
+/*
+  Toccata LV2 plugin
+
+  Copyright 2020, Paul Ferrand <paul@ferrand.cc>
+
+  Permission to use, copy, modify, and/or distribute this software for any
+  purpose with or without fee is hereby granted, provided that the above
+  copyright notice and this permission notice appear in all copies.
+
+  THIS SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include "pool.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+
+#if !defined(_WIN32) || defined(__MINGW32__)
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#if defined(__APPLE__)
+#include <dispatch/dispatch.h>
+#else
+#include <semaphore.h>
+#endif
+#define TOCCATA_HAVE_POOL 1
+#endif
+
+// Batches come every block, so idle threads spin this many times before
+// they sleep
+#define SPIN_COUNT 20000
+
+#ifdef TOCCATA_HAVE_POOL
+
+#if defined(__APPLE__)
+typedef dispatch_semaphore_t semaphore_t;
+
+static bool
+semaphore_init(semaphore_t* semaphore)
+{
+    *semaphore = dispatch_semaphore_create(0);
+    return *semaphore != NULL;
+}
+
+static void
+semaphore_destroy(semaphore_t* semaphore)
+{
+    dispatch_release(*semaphore);
+}
+
+static void
+semaphore_post(semaphore_t* semaphore)
+{
+    dispatch_semaphore_signal(*semaphore);
+}
+
+static void
+semaphore_wait(semaphore_t* semaphore)
+{
+    dispatch_semaphore_wait(*semaphore, DISPATCH_TIME_FOREVER);
+}
+#else
+typedef sem_t semaphore_t;
+
+static bool
+semaphore_init(semaphore_t* semaphore)
+{
+    return sem_init(semaphore, 0, 0) == 0;
+}
+
+static void
+semaphore_destroy(semaphore_t* semaphore)
+{
+    sem_destroy(semaphore);
+}
+
+static void
+semaphore_post(semaphore_t* semaphore)
+{
+    sem_post(semaphore);
+}
+
+static void
+semaphore_wait(semaphore_t* semaphore)
+{
+    while (sem_wait(semaphore) != 0 && errno == EINTR)
+        ;
+}
+#endif
+
+static inline void
+cpu_pause(void)
+{
+#if defined(__i386__) || defined(__x86_64__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+    __asm__ __volatile__("yield");
+#endif
+}
+
+typedef struct {
+    toccata_pool_t* pool;
+    pthread_t thread;
+    semaphore_t wake;
+    int sleeping; ///< Atomic
+} toccata_pool_thread_t;
+
+struct toccata_pool_t {
+    toccata_pool_thread_t* threads;
+    int num_threads;
+    bool priority_set;
+    bool background; ///< Runs below the audio thread
+    int spin_count; ///< Atomic
+
+    // The current batch. The task counter holds the number of tasks in its
+    // high bits, so that a thread late from the previous batch cannot take
+    // a task of the next one with a stale count.
+    toccata_task_t task;
+    void* data;
+    int next_task; ///< Atomic
+    int pending; ///< Atomic, tasks of the batch not done yet
+    unsigned generation; ///< Atomic, incremented for every batch
+    int running; ///< Atomic
+};
+
+static void
+run_tasks(toccata_pool_t* pool)
+{
+    for (;;) {
+        const int counter = __atomic_fetch_add(&pool->next_task, 1, __ATOMIC_ACQUIRE);
+        const int index = counter & 0xFFFF;
+        if (index >= counter >> 16)
+            break;
+
+        pool->task(pool->data, index);
+        __atomic_sub_fetch(&pool->pending, 1, __ATOMIC_RELEASE);
+    }
+}
+
+static void*
+work(void* data)
+{
+    toccata_pool_thread_t* thread = (toccata_pool_thread_t*)data;
+    toccata_pool_t* pool = thread->pool;
+    unsigned generation = 0;
+
+    for (;;) {
+        const int spin_count = __atomic_load_n(&pool->spin_count, __ATOMIC_RELAXED);
+        int spins = 0;
+        while (__atomic_load_n(&pool->generation, __ATOMIC_ACQUIRE) == generation) {
+            if (++spins < spin_count) {
+                cpu_pause();
+                continue;
+            }
+
+            // The batch is published before the sleeping flags are read,
+            // so either the batch is seen here or this thread is woken
+            __atomic_store_n(&thread->sleeping, 1, __ATOMIC_SEQ_CST);
+            if (__atomic_load_n(&pool->generation, __ATOMIC_SEQ_CST) == generation)
+                semaphore_wait(&thread->wake);
+            __atomic_store_n(&thread->sleeping, 0, __ATOMIC_SEQ_CST);
+            spins = 0;
+        }
+
+        if (!__atomic_load_n(&pool->running, __ATOMIC_ACQUIRE))
+            break;
+
+        generation = __atomic_load_n(&pool->generation, __ATOMIC_ACQUIRE);
+        run_tasks(pool);
+    }
+    return NULL;
+}
+
+static void
+wake_threads(toccata_pool_t* pool)
+{
+    for (int i = 0; i < pool->num_threads; ++i) {
+        toccata_pool_thread_t* thread = &pool->threads[i];
+        if (__atomic_exchange_n(&thread->sleeping, 0, __ATOMIC_SEQ_CST))
+            semaphore_post(&thread->wake);
+    }
+}
+
+toccata_pool_t*
+toccata_pool_create(int num_threads)
+{
+    toccata_pool_t* pool = (toccata_pool_t*)calloc(1, sizeof(toccata_pool_t));
+    if (!pool)
+        return NULL;
+
+    pool->threads = (toccata_pool_thread_t*)calloc(num_threads, sizeof(toccata_pool_thread_t));
+    if (!pool->threads) {
+        free(pool);
+        return NULL;
+    }
+
+    pool->running = 1;
+    pool->spin_count = SPIN_COUNT;
+    for (int i = 0; i < num_threads; ++i) {
+        toccata_pool_thread_t* thread = &pool->threads[i];
+        thread->pool = pool;
+        if (!semaphore_init(&thread->wake))
+            break;
+        if (pthread_create(&thread->thread, NULL, work, thread) != 0) {
+            semaphore_destroy(&thread->wake);
+            break;
+        }
+        pool->num_threads++;
+    }
+
+    if (pool->num_threads < num_threads) {
+        toccata_pool_free(pool);
+        return NULL;
+    }
+    return pool;
+}
+
+void
+toccata_pool_free(toccata_pool_t* pool)
+{
+    if (!pool)
+        return;
+
+    __atomic_store_n(&pool->running, 0, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&pool->generation, 1, __ATOMIC_SEQ_CST);
+    for (int i = 0; i < pool->num_threads; ++i)
+        semaphore_post(&pool->threads[i].wake);
+
+    for (int i = 0; i < pool->num_threads; ++i) {
+        pthread_join(pool->threads[i].thread, NULL);
+        semaphore_destroy(&pool->threads[i].wake);
+    }
+    free(pool->threads);
+    free(pool);
+}
+
+int
+toccata_pool_get_num_threads(const toccata_pool_t* pool)
+{
+    return pool->num_threads;
+}
+
+void
+toccata_pool_set_background(toccata_pool_t* pool)
+{
+    pool->background = true;
+    __atomic_store_n(&pool->spin_count, 0, __ATOMIC_RELAXED);
+}
+
+void
+toccata_pool_start(toccata_pool_t* pool, toccata_task_t task, void* data, int num_tasks)
+{
+    // The threads follow the scheduling of the audio thread, once it is known
+    if (!pool->priority_set) {
+        int policy;
+        struct sched_param param;
+        if (pthread_getschedparam(pthread_self(), &policy, &param) == 0 && policy != SCHED_OTHER) {
+            if (pool->background && param.sched_priority > sched_get_priority_min(policy))
+                param.sched_priority--;
+            for (int i = 0; i < pool->num_threads; ++i)
+                pthread_setschedparam(pool->threads[i].thread, policy, &param);
+        }
+        pool->priority_set = true;
+    }
+
+    pool->task = task;
+    pool->data = data;
+    __atomic_store_n(&pool->pending, num_tasks, __ATOMIC_RELAXED);
+    __atomic_store_n(&pool->next_task, num_tasks << 16, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&pool->generation, 1, __ATOMIC_SEQ_CST);
+    wake_threads(pool);
+}
+
+void
+toccata_pool_wait(toccata_pool_t* pool)
+{
+    while (__atomic_load_n(&pool->pending, __ATOMIC_ACQUIRE) > 0)
+        cpu_pause();
+}
+
+void
+toccata_pool_run(toccata_pool_t* pool, toccata_task_t task, void* data, int num_tasks)
+{
+    toccata_pool_start(pool, task, data, num_tasks);
+    run_tasks(pool);
+    toccata_pool_wait(pool);
+}
+
+#else
+
+toccata_pool_t*
+toccata_pool_create(int num_threads)
+{
+    (void)num_threads;
+    return NULL;
+}
+
+void
+toccata_pool_free(toccata_pool_t* pool)
+{
+    (void)pool;
+}
+
+int
+toccata_pool_get_num_threads(const toccata_pool_t* pool)
+{
+    (void)pool;
+    return 0;
+}
+
+void
+toccata_pool_set_background(toccata_pool_t* pool)
+{
+    (void)pool;
+}
+
+void
+toccata_pool_start(toccata_pool_t* pool, toccata_task_t task, void* data, int num_tasks)
+{
+    toccata_pool_run(pool, task, data, num_tasks);
+}
+
+void
+toccata_pool_wait(toccata_pool_t* pool)
+{
+    (void)pool;
+}
+
+void
+toccata_pool_run(toccata_pool_t* pool, toccata_task_t task, void* data, int num_tasks)
+{
+    (void)pool;
+    for (int i = 0; i < num_tasks; ++i)
+        task(data, i);
+}
+
+#endif
@@ -0,0 +1,66 @@
+/*
+  Toccata LV2 plugin
+
+  Copyright 2020, Paul Ferrand <paul@ferrand.cc>
+
+  Permission to use, copy, modify, and/or distribute this software for any
+  purpose with or without fee is hereby granted, provided that the above
+  copyright notice and this permission notice appear in all copies.
+
+  THIS SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#ifndef TOCCATA_POOL_H
+#define TOCCATA_POOL_H
+
+/**
+   Threads that share the tasks of the audio thread. The threads are
+   started with the pool, and take the priority of the audio thread the
+   first time it runs tasks on them.
+*/
+typedef struct toccata_pool_t toccata_pool_t;
+
+/**
+   Run task `index` of a batch, on any thread of the pool.
+*/
+typedef void (*toccata_task_t)(void* data, int index);
+
+/**
+   Start a pool of `num_threads` threads, which help the calling thread.
+   Returns NULL if the threads could not be started, or on platforms
+   without threads.
+*/
+toccata_pool_t* toccata_pool_create(int num_threads);
+void toccata_pool_free(toccata_pool_t* pool);
+int toccata_pool_get_num_threads(const toccata_pool_t* pool);
+
+/**
+   Make the threads of the pool run below the priority of the audio
+   thread, and sleep as soon as they are idle, for tasks that have more
+   than a block to finish. Call it before the pool runs any task.
+*/
+void toccata_pool_set_background(toccata_pool_t* pool);
+
+/**
+   Run tasks 0 to `num_tasks - 1` on the pool and the calling thread, and
+   return once they are all done. The pool waits for tasks without locks
+   and the calling thread spins until they are done, so this is real-time
+   safe. Only one thread may run tasks at a time.
+*/
+void toccata_pool_run(toccata_pool_t* pool, toccata_task_t task, void* data, int num_tasks);
+
+/**
+   Run tasks 0 to `num_tasks - 1` on the threads of the pool only, and
+   return right away. toccata_pool_wait() returns once they are all done,
+   and must be called before the pool runs other tasks. Real-time safe.
+*/
+void toccata_pool_start(toccata_pool_t* pool, toccata_task_t task, void* data, int num_tasks);
+void toccata_pool_wait(toccata_pool_t* pool);
+
+#endif // TOCCATA_POOL_H
@@ -0,0 +1,619 @@
+/*
+  Toccata LV2 plugin
+
+  Copyright 2020, Paul Ferrand <paul@ferrand.cc>
+
+  Permission to use, copy, modify, and/or distribute this software for any
+  purpose with or without fee is hereby granted, provided that the above
+  copyright notice and this permission notice appear in all copies.
+
+  THIS SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include "reverb.h"
+#include "dsp.h"
+#include "fft.h"
+#include "memlock.h"
+#include "pool.h"
+#include "wav.h"
+
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#if !defined(_WIN32) || defined(__MINGW32__)
+#include <unistd.h>
+#endif
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+#define MAX_PATH_SIZE 1024
+
+// The first frames of a response are convolved directly, and the rest by
+// levels of partitions of growing size. Partition p of a level starts at
+// `offset + p * block_size` in the response. Levels with blocks shorter
+// than two host blocks run at once when their block is in, so their
+// offset is one block; the others run in the background and are due one
+// block after they start, so their offset is two blocks. A background
+// partition is then never due in the run() that started it.
+#define HEAD_FRAMES 64
+#define MAX_LEVELS 8
+// Blocks grow by this factor from the head, up to a last level of at
+// least MIN_LAST_BLOCK_SIZE frames and twice the host block
+#define LEVEL_GROWTH 8
+#define MIN_LAST_BLOCK_SIZE 4096
+
+// Frames mixed at once, which bounds the scratch buffers
+#define CHUNK_FRAMES 256
+
+typedef struct {
+    int block_size; ///< Frames per partition, half the size of the FFT
+    int offset; ///< Of the first partition in the response
+    int num_partitions;
+    bool background; ///< Partitions are due one block after they start
+    bool pending; ///< A partition started and its output is not collected yet
+    toccata_pool_t* pool; ///< Runs the background partitions, or NULL to spread them over the block
+    int step; ///< Next step of the partition, when it is spread
+    float* response_real; ///< Spectra of the partitions, one after the other
+    float* response_imag;
+    float* spectra_real; ///< Ring of the spectra of the last inputs
+    float* spectra_imag;
+    int position; ///< Of the newest spectrum in the ring
+    int num_spectra; ///< Written in the ring since the last reset, up to `num_partitions`
+    float* input; ///< The last two blocks of input
+    float* sum_real;
+    float* sum_imag;
+    double* fft_real;
+    double* fft_imag;
+    float* output[2]; ///< One block per channel
+} level_t;
+
+typedef struct {
+    float head[2][HEAD_FRAMES]; ///< Start of the response per channel, reversed
+    level_t levels[MAX_LEVELS];
+    int num_levels;
+    uint32_t ring_size; ///< Of the history and outputs, twice the largest block, a power of 2
+    uint32_t ring_mask;
+    float* history; ///< Input, written twice so that any window is contiguous
+    float* output[2]; ///< Output of the levels, cleared once read
+    uint32_t time; ///< Frames processed, which wraps with the buffers
+    int silent_frames; ///< Frames since the last input, up to `tail_frames`
+    int tail_frames; ///< Silent frames after which every buffer is zero
+    char* storage;
+    size_t storage_size;
+    bool storage_locked;
+} convolver_t;
+
+struct toccata_reverb_t {
+    convolver_t rooms[TOCCATA_NUM_ROOMS];
+    int room;
+    float mix;
+    float dry_gain; ///< At the end of the last block
+    float wet_gain;
+    float input[CHUNK_FRAMES];
+    float wet[2][CHUNK_FRAMES];
+};
+
+static const char* const room_names[TOCCATA_NUM_ROOMS] = { "chapel", "cathedral" };
+
+/**
+   Take `count` elements of `size` bytes from `storage`, or only count them
+   while it is NULL.
+*/
+static void*
+carve(char* storage, size_t* used, size_t count, size_t size)
+{
+    void* data = storage ? storage + *used : NULL;
+    *used += (count * size + 15) & ~(size_t)15;
+    return data;
+}
+
+/**
+   Point the buffers of the convolver into its storage, and return the
+   size it takes.
+*/
+static size_t
+layout(convolver_t* convolver)
+{
+    char* storage = convolver->storage;
+    size_t used = 0;
+
+    convolver->history = (float*)carve(storage, &used, 2 * convolver->ring_size, sizeof(float));
+    for (int c = 0; c < 2; ++c)
+        convolver->output[c] = (float*)carve(storage, &used, convolver->ring_size, sizeof(float));
+
+    for (int l = 0; l < convolver->num_levels; ++l) {
+        level_t* level = &convolver->levels[l];
+        if (level->num_partitions == 0)
+            continue;
+        const size_t fft_size = 2 * (size_t)level->block_size;
+        const size_t spectra_size = fft_size * (size_t)level->num_partitions;
+        level->response_real = (float*)carve(storage, &used, spectra_size, sizeof(float));
+        level->response_imag = (float*)carve(storage, &used, spectra_size, sizeof(float));
+        level->spectra_real = (float*)carve(storage, &used, spectra_size, sizeof(float));
+        level->spectra_imag = (float*)carve(storage, &used, spectra_size, sizeof(float));
+        level->input = (float*)carve(storage, &used, fft_size, sizeof(float));
+        level->sum_real = (float*)carve(storage, &used, fft_size, sizeof(float));
+        level->sum_imag = (float*)carve(storage, &used, fft_size, sizeof(float));
+        level->fft_real = (double*)carve(storage, &used, fft_size, sizeof(double));
+        level->fft_imag = (double*)carve(storage, &used, fft_size, sizeof(double));
+        for (int c = 0; c < 2; ++c)
+            level->output[c] = (float*)carve(storage, &used, level->block_size, sizeof(float));
+    }
+    return used;
+}
+
+// A partition is computed in steps: the spectrum of the input, then one
+// product per partition, then the output
+static int
+num_level_steps(const level_t* level)
+{
+    return level->num_partitions + 2;
+}
+
+static void
+run_level_steps(level_t* level, int first, int last)
+{
+    const int block_size = level->block_size;
+    const int fft_size = 2 * block_size;
+
+    for (int step = first; step < last; ++step) {
+        if (step == 0) {
+            for (int i = 0; i < fft_size; ++i) {
+                level->fft_real[i] = level->input[i];
+                level->fft_imag[i] = 0.0;
+            }
+            toccata_fft(level->fft_real, level->fft_imag, fft_size, false);
+
+            // The ring runs backwards, so that partition p multiplies the
+            // spectrum p places after the newest one
+            level->position = (level->position + level->num_partitions - 1) % level->num_partitions;
+            if (level->num_spectra < level->num_partitions)
+                level->num_spectra++;
+            float* newest_real = level->spectra_real + level->position * fft_size;
+            float* newest_imag = level->spectra_imag + level->position * fft_size;
+            for (int i = 0; i < fft_size; ++i) {
+                newest_real[i] = (float)level->fft_real[i];
+                newest_imag[i] = (float)level->fft_imag[i];
+            }
+            memset(level->sum_real, 0, fft_size * sizeof(float));
+            memset(level->sum_imag, 0, fft_size * sizeof(float));
+        } else if (step <= level->num_spectra) {
+            // Slots not written since the last reset hold stale input
+            const int p = step - 1;
+            const int slot = (level->position + p) % level->num_partitions;
+            toccata_complex_multiply_add(level->sum_real, level->sum_imag,
+                level->spectra_real + slot * fft_size, level->spectra_imag + slot * fft_size,
+                level->response_real + p * fft_size, level->response_imag + p * fft_size, fft_size);
+        } else if (step > level->num_partitions) {
+            // The response holds the left channel in its real part and the
+            // right one in its imaginary part, and the input is real, so the
+            // channels come out on their own parts. The first half wrapped
+            // around.
+            for (int i = 0; i < fft_size; ++i) {
+                level->fft_real[i] = level->sum_real[i];
+                level->fft_imag[i] = level->sum_imag[i];
+            }
+            toccata_fft(level->fft_real, level->fft_imag, fft_size, true);
+            for (int i = 0; i < block_size; ++i) {
+                level->output[0][i] = (float)level->fft_real[block_size + i];
+                level->output[1][i] = (float)level->fft_imag[block_size + i];
+            }
+        }
+    }
+}
+
+/**
+   Convolve the input of a level with its partitions.
+*/
+static void
+run_level(void* data, int index)
+{
+    (void)index;
+    level_t* level = (level_t*)data;
+    run_level_steps(level, 0, num_level_steps(level));
+}
+
+static void
+collect_level(convolver_t* convolver, level_t* level)
+{
+    // Blocks start on a multiple of their size, so they never wrap
+    const int start = (int)(convolver->time & convolver->ring_mask);
+    for (int c = 0; c < 2; ++c)
+        toccata_mix(convolver->output[c] + start, level->output[c], 1.0f, level->block_size);
+}
+
+static void
+wait_level(level_t* level)
+{
+    if (level->pending && level->pool)
+        toccata_pool_wait(level->pool);
+}
+
+/**
+   Run the steps of a spread partition that are due by the end of the
+   current head block, so that the last one runs just before the output
+   is collected.
+*/
+static void
+advance_level(convolver_t* convolver, level_t* level)
+{
+    const int num_steps = num_level_steps(level);
+    const int num_blocks = level->block_size / HEAD_FRAMES;
+    const int block = (int)((convolver->time & (uint32_t)(level->block_size - 1)) / HEAD_FRAMES) + 1;
+    const int last = num_steps * block / num_blocks;
+    run_level_steps(level, level->step, last);
+    level->step = last;
+}
+
+/**
+   At the start of a head block, start the levels whose block begins now,
+   after collecting the output of their last partition, and go on with
+   the spread partitions.
+*/
+static void
+start_levels(convolver_t* convolver)
+{
+    for (int l = 0; l < convolver->num_levels; ++l) {
+        level_t* level = &convolver->levels[l];
+        if (level->num_partitions == 0)
+            continue;
+
+        if ((convolver->time & (uint32_t)(level->block_size - 1)) == 0) {
+            if (level->pending) {
+                wait_level(level);
+                collect_level(convolver, level);
+                level->pending = false;
+            }
+
+            const int window = 2 * level->block_size;
+            memcpy(level->input, convolver->history + ((convolver->time - (uint32_t)window) & convolver->ring_mask),
+                window * sizeof(float));
+
+            if (!level->background) {
+                run_level(level, 0);
+                collect_level(convolver, level);
+                continue;
+            }
+
+            if (level->pool)
+                toccata_pool_start(level->pool, run_level, level, 1);
+            level->step = 0;
+            level->pending = true;
+        }
+
+        if (level->pending && !level->pool)
+            advance_level(convolver, level);
+    }
+}
+
+static bool
+convolver_idle(const convolver_t* convolver)
+{
+    return convolver->silent_frames >= convolver->tail_frames;
+}
+
+/**
+   Drop the reverb in flight, and leave the convolver idle as if its tail
+   had rung out.
+*/
+static void
+convolver_reset(convolver_t* convolver)
+{
+    for (int l = 0; l < convolver->num_levels; ++l) {
+        level_t* level = &convolver->levels[l];
+        wait_level(level);
+        level->pending = false;
+        level->step = 0;
+        level->num_spectra = 0;
+    }
+    memset(convolver->history, 0, 2 * convolver->ring_size * sizeof(float));
+    for (int c = 0; c < 2; ++c)
+        memset(convolver->output[c], 0, convolver->ring_size * sizeof(float));
+    convolver->silent_frames = convolver->tail_frames;
+}
+
+/**
+   Add the reverb of `input` to `left` and `right`. A NULL input is
+   silence.
+*/
+static void
+convolve(convolver_t* convolver, const float* input, float* left, float* right, int num_frames)
+{
+    for (int done = 0; done < num_frames;) {
+        const uint32_t phase = convolver->time & (HEAD_FRAMES - 1);
+        if (phase == 0)
+            start_levels(convolver);
+
+        int frames = HEAD_FRAMES - (int)phase;
+        if (frames > num_frames - done)
+            frames = num_frames - done;
+
+        for (int i = 0; i < frames; ++i) {
+            const float sample = input ? input[done + i] : 0.0f;
+            const uint32_t index = (convolver->time + (uint32_t)i) & convolver->ring_mask;
+            convolver->history[index] = sample;
+            convolver->history[index + convolver->ring_size] = sample;
+        }
+
+        const int start = (int)(convolver->time & convolver->ring_mask);
+        for (int i = 0; i < frames; ++i) {
+            const float* window =
+                convolver->history + ((convolver->time + (uint32_t)i - (HEAD_FRAMES - 1)) & convolver->ring_mask);
+            left[done + i] += toccata_dot(window, convolver->head[0], HEAD_FRAMES) + convolver->output[0][start + i];
+            right[done + i] += toccata_dot(window, convolver->head[1], HEAD_FRAMES) + convolver->output[1][start + i];
+        }
+        for (int c = 0; c < 2; ++c)
+            memset(convolver->output[c] + start, 0, frames * sizeof(float));
+
+        if (input)
+            convolver->silent_frames = 0;
+        else if (convolver->silent_frames < convolver->tail_frames)
+            convolver->silent_frames += frames;
+
+        convolver->time += (uint32_t)frames;
+        done += frames;
+    }
+}
+
+/**
+   Background threads only help with more than one core: on a single one,
+   the audio thread would spin while waiting for a thread it preempts, so
+   it spreads the partitions over its own blocks instead.
+*/
+static bool
+have_spare_cores(void)
+{
+#if defined(_SC_NPROCESSORS_ONLN)
+    return sysconf(_SC_NPROCESSORS_ONLN) > 1;
+#else
+    return true;
+#endif
+}
+
+static void
+convolver_free(convolver_t* convolver)
+{
+    for (int l = 0; l < convolver->num_levels; ++l) {
+        wait_level(&convolver->levels[l]);
+        toccata_pool_free(convolver->levels[l].pool);
+    }
+    if (convolver->storage) {
+        toccata_unlock_buffer(convolver->storage, convolver->storage_size, &convolver->storage_locked);
+        free(convolver->storage);
+    }
+}
+
+/**
+   Block sizes of the levels, from the head up.
+*/
+static int
+plan_levels(int max_block_size, int* block_sizes)
+{
+    int last = MIN_LAST_BLOCK_SIZE;
+    while (last < 2 * max_block_size)
+        last *= 2;
+
+    int num_levels = 0;
+    for (int size = HEAD_FRAMES; size < last && num_levels < MAX_LEVELS - 1; size *= LEVEL_GROWTH)
+        block_sizes[num_levels++] = size;
+    block_sizes[num_levels++] = last;
+    return num_levels;
+}
+
+static bool
+convolver_init(convolver_t* convolver, const char* path, float sample_rate, int max_block_size)
+{
+    int num_frames;
+    int num_channels;
+    float file_rate;
+    double* samples = toccata_wav_read(path, &num_frames, &num_channels, &file_rate);
+    if (!samples)
+        return false;
+
+    // Resample linearly to the rate of the synth, both channels of stereo
+    // files and the only one of mono files
+    const double ratio = file_rate / sample_rate;
+    const int length = (int)((num_frames - 1) / ratio) + 1;
+    float* response[2];
+    response[0] = (float*)malloc(length * sizeof(float));
+    response[1] = (float*)malloc(length * sizeof(float));
+    if (!response[0] || !response[1]) {
+        free(response[0]);
+        free(response[1]);
+        free(samples);
+        return false;
+    }
+
+    double energy = 0.0;
+    for (int c = 0; c < 2; ++c) {
+        const int channel = c < num_channels ? c : num_channels - 1;
+        for (int i = 0; i < length; ++i) {
+            const double position = i * ratio;
+            const int frame = (int)position;
+            const double current = samples[frame * num_channels + channel];
+            const double next = frame + 1 < num_frames ? samples[(frame + 1) * num_channels + channel] : 0.0;
+            const double value = current + (position - frame) * (next - current);
+            response[c][i] = (float)value;
+            energy += value * value;
+        }
+    }
+    free(samples);
+
+    // Unit gain on average over the channels for uncorrelated input
+    const float scale = energy > 0.0 ? (float)sqrt(2.0 / energy) : 0.0f;
+    for (int c = 0; c < 2; ++c) {
+        for (int i = 0; i < length; ++i)
+            response[c][i] *= scale;
+        for (int i = 0; i < HEAD_FRAMES; ++i)
+            convolver->head[c][HEAD_FRAMES - 1 - i] = i < length ? response[c][i] : 0.0f;
+    }
+
+    int block_sizes[MAX_LEVELS];
+    convolver->num_levels = plan_levels(max_block_size, block_sizes);
+    convolver->ring_size = 2 * (uint32_t)block_sizes[convolver->num_levels - 1];
+    convolver->ring_mask = convolver->ring_size - 1;
+    for (int l = 0; l < convolver->num_levels; ++l) {
+        level_t* level = &convolver->levels[l];
+        level->block_size = block_sizes[l];
+        level->background = l > 0 && level->block_size >= 2 * max_block_size;
+        level->offset = level->background ? 2 * level->block_size : level->block_size;
+    }
+
+    // Each level covers the response up to the next one
+    const bool threaded = have_spare_cores();
+    for (int l = 0; l < convolver->num_levels; ++l) {
+        level_t* level = &convolver->levels[l];
+        const int end = l + 1 < convolver->num_levels ? convolver->levels[l + 1].offset : length;
+        const int covered = (end < length ? end : length) - level->offset;
+        level->num_partitions = covered > 0 ? (covered + level->block_size - 1) / level->block_size : 0;
+        if (level->background && level->num_partitions > 0 && threaded) {
+            level->pool = toccata_pool_create(1);
+            if (level->pool)
+                toccata_pool_set_background(level->pool);
+        }
+    }
+
+    convolver->storage = NULL;
+    convolver->storage_size = layout(convolver);
+    convolver->storage = (char*)calloc(1, convolver->storage_size);
+    if (!convolver->storage) {
+        free(response[0]);
+        free(response[1]);
+        return false;
+    }
+    layout(convolver);
+
+    for (int l = 0; l < convolver->num_levels; ++l) {
+        level_t* level = &convolver->levels[l];
+        const int fft_size = 2 * level->block_size;
+        for (int p = 0; p < level->num_partitions; ++p) {
+            const int start = level->offset + p * level->block_size;
+            for (int i = 0; i < fft_size; ++i) {
+                const bool inside = i < level->block_size && start + i < length;
+                level->fft_real[i] = inside ? response[0][start + i] : 0.0;
+                level->fft_imag[i] = inside ? response[1][start + i] : 0.0;
+            }
+            toccata_fft(level->fft_real, level->fft_imag, fft_size, false);
+            for (int i = 0; i < fft_size; ++i) {
+                level->response_real[p * fft_size + i] = (float)level->fft_real[i];
+                level->response_imag[p * fft_size + i] = (float)level->fft_imag[i];
+            }
+        }
+    }
+    free(response[0]);
+    free(response[1]);
+
+    // Once the input is silent for the whole response and the longest
+    // windows, every buffer holds zeros again
+    convolver->tail_frames = length + 3 * (int)convolver->ring_size / 2;
+    convolver->silent_frames = convolver->tail_frames;
+    toccata_lock_buffer(convolver->storage, convolver->storage_size, &convolver->storage_locked);
+    return true;
+}
+
+toccata_reverb_t*
+toccata_reverb_create(const char* directory, float sample_rate, int max_block_size)
+{
+    toccata_reverb_t* reverb = (toccata_reverb_t*)calloc(1, sizeof(toccata_reverb_t));
+    if (!reverb)
+        return NULL;
+
+    char path[MAX_PATH_SIZE];
+    for (int r = 0; r < TOCCATA_NUM_ROOMS; ++r) {
+        snprintf(path, MAX_PATH_SIZE, "%sir_%s.wav", directory, room_names[r]);
+        if (!convolver_init(&reverb->rooms[r], path, sample_rate, max_block_size)) {
+            toccata_reverb_free(reverb);
+            return NULL;
+        }
+    }
+
+    reverb->room = TOCCATA_ROOM_CHAPEL;
+    reverb->dry_gain = 1.0f;
+    return reverb;
+}
+
+void
+toccata_reverb_free(toccata_reverb_t* reverb)
+{
+    if (!reverb)
+        return;
+
+    for (int r = 0; r < TOCCATA_NUM_ROOMS; ++r)
+        convolver_free(&reverb->rooms[r]);
+    free(reverb);
+}
+
+void
+toccata_reverb_set_room(toccata_reverb_t* reverb, int room)
+{
+    if (room >= 0 && room < TOCCATA_NUM_ROOMS)
+        reverb->room = room;
+}
+
+void
+toccata_reverb_set_mix(toccata_reverb_t* reverb, float mix)
+{
+    reverb->mix = mix < 0.0f ? 0.0f : (mix > 1.0f ? 1.0f : mix);
+}
+
+void
+toccata_reverb_process(toccata_reverb_t* reverb, float* left, float* right, int num_frames)
+{
+    // Equal power between the dry signal and the reverb
+    const float angle = reverb->mix * (float)(M_PI / 2);
+    const float dry_gain = reverb->mix < 1.0f ? cosf(angle) : 0.0f;
+    const float wet_gain = reverb->mix > 0.0f ? sinf(angle) : 0.0f;
+    const bool wet = wet_gain > 0.0f || reverb->wet_gain > 0.0f;
+
+    // Once the reverb is faded out, its tails would never be heard
+    if (!wet) {
+        for (int r = 0; r < TOCCATA_NUM_ROOMS; ++r) {
+            if (!convolver_idle(&reverb->rooms[r]))
+                convolver_reset(&reverb->rooms[r]);
+        }
+        return;
+    }
+    if (num_frames == 0)
+        return;
+
+    // The current room is fed, and the others only ring out until they
+    // are silent
+    const float dry_step = (dry_gain - reverb->dry_gain) / num_frames;
+    const float wet_step = (wet_gain - reverb->wet_gain) / num_frames;
+    for (int done = 0; done < num_frames; done += CHUNK_FRAMES) {
+        const int frames = num_frames - done < CHUNK_FRAMES ? num_frames - done : CHUNK_FRAMES;
+        for (int i = 0; i < frames; ++i)
+            reverb->input[i] = 0.5f * (left[done + i] + right[done + i]);
+
+        memset(reverb->wet[0], 0, frames * sizeof(float));
+        memset(reverb->wet[1], 0, frames * sizeof(float));
+        for (int r = 0; r < TOCCATA_NUM_ROOMS; ++r) {
+            convolver_t* room = &reverb->rooms[r];
+            if (r == reverb->room)
+                convolve(room, reverb->input, reverb->wet[0], reverb->wet[1], frames);
+            else if (!convolver_idle(room))
+                convolve(room, NULL, reverb->wet[0], reverb->wet[1], frames);
+        }
+
+        const float dry = reverb->dry_gain + (float)done * dry_step;
+        const float reverberated = reverb->wet_gain + (float)done * wet_step;
+        toccata_scale_ramp(left + done, dry, dry_step, frames);
+        toccata_scale_ramp(right + done, dry, dry_step, frames);
+        toccata_mix_ramp(left + done, reverb->wet[0], reverberated, wet_step, frames);
+        toccata_mix_ramp(right + done, reverb->wet[1], reverberated, wet_step, frames);
+    }
+
+    reverb->dry_gain = dry_gain;
+    reverb->wet_gain = wet_gain;
+}
@@ -0,0 +1,65 @@
+/*
+  Toccata LV2 plugin
+
+  Copyright 2020, Paul Ferrand <paul@ferrand.cc>
+
+  Permission to use, copy, modify, and/or distribute this software for any
+  purpose with or without fee is hereby granted, provided that the above
+  copyright notice and this permission notice appear in all copies.
+
+  THIS SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#ifndef TOCCATA_REVERB_H
+#define TOCCATA_REVERB_H
+
+/**
+   Convolution reverb with the impulse responses of the rooms shipped in
+   the instrument. The start of each response is convolved on the calling
+   thread, so that the reverb adds no latency, and the rest in ever longer
+   partitions. Partitions of at least two host blocks run on background
+   threads, and are due at least one host block after the one that
+   started them.
+*/
+typedef struct toccata_reverb_t toccata_reverb_t;
+
+typedef enum {
+    TOCCATA_ROOM_CHAPEL = 0,
+    TOCCATA_ROOM_CATHEDRAL,
+    TOCCATA_NUM_ROOMS
+} toccata_room_t;
+
+/**
+   Load the responses of the rooms from `directory`, resampled to
+   `sample_rate`, and partitioned for host blocks of up to
+   `max_block_size` frames. Returns NULL if one cannot be loaded. A
+   reverb for another rate or block size is created anew.
+*/
+toccata_reverb_t* toccata_reverb_create(const char* directory, float sample_rate, int max_block_size);
+void toccata_reverb_free(toccata_reverb_t* reverb);
+
+/**
+   Switch to another room. The tail of the previous one rings out.
+   Real-time safe.
+*/
+void toccata_reverb_set_room(toccata_reverb_t* reverb, int room);
+
+/**
+   Set the balance between the dry signal, at 0, and the reverb, at 1.
+   Once the reverb has faded out at 0, its tails are dropped and it does
+   nothing until the mix rises again. Real-time safe.
+*/
+void toccata_reverb_set_mix(toccata_reverb_t* reverb, float mix);
+
+/**
+   Add the reverb to a stereo block in place. Real-time safe.
+*/
+void toccata_reverb_process(toccata_reverb_t* reverb, float* left, float* right, int num_frames);
+
+#endif // TOCCATA_REVERB_H
@@ -0,0 +1,2349 @@
+/*
+  Toccata LV2 plugin
+
+  Copyright 2020, Paul Ferrand <paul@ferrand.cc>
+
+  Permission to use, copy, modify, and/or distribute this software for any
+  purpose with or without fee is hereby granted, provided that the above
+  copyright notice and this permission notice appear in all copies.
+
+  THIS SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include "synth.h"
+#include "dsp.h"
+#include "memlock.h"
+#include "organ.h"
+#include "wavetable.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+#define MAX_EVENTS 1024
+#define MAX_PATH_SIZE 1024
+#define CRESCENDO_CC 4
+#define EXPRESSION_CC 11
+#define SUSTAIN_CC 64
+#define ALL_SOUND_OFF_CC 120
+#define ALL_NOTES_OFF_CC 123
+// Exponential segments reach -60 dB of their range at their nominal time
+#define EXPONENTIAL_TARGET 1e-3f
+// Released voices stop at -80 dB
+#define ENVELOPE_FLOOR 1e-4f
+#define PHASE_SCALE 4294967296.0
+// Keys in a crossfade play a blend of both tables, so that each pipe is
+// a single voice
+#define MAX_ZONES 1
+// The zones of a pipe, then its attack transient
+#define VOICES_PER_PIPE (MAX_ZONES + 1)
+// The voices of each pipe of each stop, one merged voice per key of each
+// division, then the overflow voices
+#define NUM_PIPE_VOICES (TOCCATA_NUM_STOPS * TOCCATA_NUM_KEYS * VOICES_PER_PIPE)
+#define NUM_MERGED_VOICES (TOCCATA_NUM_DIVISIONS * TOCCATA_NUM_KEYS)
+#define NUM_FIXED_VOICES (NUM_PIPE_VOICES + NUM_MERGED_VOICES)
+// Merged voices play on their own bus, after the stop buses
+#define MERGED_BUS TOCCATA_NUM_STOPS
+#define NUM_BUSES (TOCCATA_NUM_STOPS + 1)
+// Merged voices are spread over the render tasks, each with its own merged
+// bus, all after the first one
+#define NUM_MERGED_BUSES (NUM_BUSES + TOCCATA_MAX_RENDER_THREADS - 1)
+// While the swell box is not open, the merged voices of the enclosed
+// division play on buses of their own, one per task, and the enclosed
+// stops and merged voices of each output sum on its swell bus
+#define ENCLOSED_MERGED_BUS NUM_MERGED_BUSES
+#define SWELL_BUS (ENCLOSED_MERGED_BUS + TOCCATA_MAX_RENDER_THREADS)
+#define NUM_ALLOCATED_BUSES (SWELL_BUS + TOCCATA_NUM_OUTPUTS)
+// Partials above this, relative to the lowest rank, are dropped from merged tables
+#define MAX_MERGED_HARMONICS 4096
+// Merged tables are rich, so they get fewer points per harmonic than the ranks
+#define MERGED_POINTS_PER_HARMONIC 16
+#define MIN_MERGED_TABLE_BITS 8
+// Buses and outputs are stereo, the left channel then the right one
+#define NUM_CHANNELS 2
+#define NUM_OUTPUT_CHANNELS (NUM_CHANNELS * TOCCATA_NUM_OUTPUTS)
+// Pipes on the sides of the case are panned between these, from the
+// smallest to the largest
+#define INNER_PIPE_PAN 0.1f
+#define OUTER_PIPE_PAN 0.8f
+// Each output channel has its own decimator history, followed by one
+// segment at the render rate
+#define OVERSAMPLED_FRAMES(samples_per_block) (TOCCATA_DECIMATOR_HISTORY + (samples_per_block))
+// Sizes of the render buffers, in bytes
+#define STOP_BUSES_SIZE(samples_per_block) (NUM_ALLOCATED_BUSES * NUM_CHANNELS * (samples_per_block) * sizeof(float))
+#define ENVELOPE_SIZE(samples_per_block) (TOCCATA_MAX_RENDER_THREADS * (samples_per_block) * sizeof(float))
+#define OVERSAMPLED_SIZE(samples_per_block) (NUM_OUTPUT_CHANNELS * OVERSAMPLED_FRAMES(samples_per_block) * sizeof(float))
+#if defined(_MSC_VER)
+#define FORCE_INLINE __forceinline
+#else
+#define FORCE_INLINE inline __attribute__((always_inline))
+#endif
+// Starting or stopping the oversampling crossfades the decimation over this time
+#define OVERSAMPLING_FADE_TIME 0.005f
+// Swing of the wind at full tremulant depth, in amplitude and in pitch
+#define TREMULANT_AMPLITUDE 0.3f
+#define TREMULANT_PITCH 0.006f
+#define DEFAULT_TREMULANT_RATE 6.0f
+// While the tremulant or the wind bends the pitch, which is constant over a
+// segment, segments are cut to this many frames at the render rate
+#define MODULATION_SEGMENT_SIZE 128
+// The wind supply of a division drops by up to WIND_SAG of its pressure,
+// half of it under a load of WIND_SUPPLY middle C pipes, and the reservoir
+// follows the load over WIND_RESPONSE_TIME. Pitch drops by WIND_PITCH of
+// the pressure loss.
+#define WIND_SAG 0.06f
+#define WIND_SUPPLY 40.0f
+#define WIND_RESPONSE_TIME 0.05f
+#define WIND_PITCH 0.05f
+#define WIND_REFERENCE_FREQUENCY 261.63f
+// The closed swell box damps the enclosed division to SWELL_CLOSED_GAIN,
+// through a lowpass that opens from SWELL_CLOSED_CUTOFF, and the shutters
+// follow the expression over SWELL_RESPONSE_TIME
+#define SWELL_CLOSED_GAIN 0.3f
+#define SWELL_CLOSED_CUTOFF 600.0f
+#define SWELL_OPEN_CUTOFF 20000.0f
+#define SWELL_RESPONSE_TIME 0.03f
+// Below this, the lowpass states are flushed to 0 rather than left to
+// decay into denormals
+#define SWELL_STATE_FLOOR 1e-15f
+
+typedef enum {
+    EVENT_NOTE_ON,
+    EVENT_NOTE_OFF,
+    EVENT_CC,
+    EVENT_STOP_GAIN
+} toccata_event_type_t;
+
+typedef struct {
+    int delay;
+    toccata_event_type_t type;
+    int division;
+    int number;
+    float value;
+} toccata_event_t;
+
+typedef struct {
+    const toccata_wavetable_t* table;
+    float gain; ///< Crossfade gain of the table on this key
+    float sustain;
+} toccata_zone_t;
+
+/**
+   Everything needed to start the pipe of a rank on a given key.
+*/
+typedef struct {
+    toccata_zone_t zones[MAX_ZONES];
+    int num_zones;
+    toccata_zone_t attack_zone; ///< Onset of the pipe, with no table if the rank has none
+    const float* pan_gains; ///< Left and right, from the layout of the rank
+    float frequency;
+    int multiplier; ///< Of the key frequency, or 0 if the pipe cannot be merged
+    float wind; ///< Wind drawn relative to a middle C pipe
+    float attack;
+    float decay;
+} toccata_pipe_t;
+
+typedef enum {
+    STAGE_ATTACK,
+    STAGE_DECAY,
+    STAGE_SUSTAIN,
+    STAGE_RELEASE
+} toccata_stage_t;
+
+typedef struct {
+    bool active;
+    bool listed; ///< In the list of active voices, possibly until the end of the segment
+    bool sustained; ///< Note-off received while the sustain pedal was down
+    int stop; ///< Bus of the voice, MERGED_BUS for merged voices
+    int division;
+    int key;
+    uint32_t age;
+    const toccata_mip_t* mip;
+    uint32_t phase;
+    uint32_t phase_increment;
+    int multiplier; ///< Of the key increment, or 0 if the pipe is not locked to the key phase
+    float gains[NUM_CHANNELS]; ///< Left and right, with the pan of the pipe
+    float wind; ///< Drawn from the division while the key is held
+    toccata_stage_t stage;
+    float level;
+    float peak;
+    float attack_step;
+    float decay_rate;
+    float sustain;
+    float release_rate;
+    // Linear crossfade from the attack transient to the pipe, on top of the
+    // envelope: the transient fades out and is freed, the pipe fades in
+    float fade;
+    float fade_step; ///< Per frame, 0 once the crossfade is over
+} toccata_voice_t;
+
+struct toccata_synth_buffers_t {
+    int samples_per_block;
+    float* stop_buses;
+    float* envelope;
+    float* oversampled;
+    bool stop_buses_locked; ///< Each buffer is unlocked only if mlock() took it
+    bool envelope_locked;
+    bool oversampled_locked;
+};
+
+/**
+   The steady state of a registration, summed into one table per key and
+   played at the key frequency. Since all pipes are phase-locked to their
+   key, a merged voice and the pipe voices it replaces sound the same.
+*/
+struct toccata_registration_t {
+    float stop_gains[TOCCATA_NUM_STOPS];
+    int rank_outputs[TOCCATA_NUM_RANKS];
+    int output; ///< Output of the merged ranks
+    int layout; ///< Layout of the merged ranks, which gives the pan of the merged voices
+    bool merged[TOCCATA_NUM_STOPS]; ///< Drawn stops that are part of the tables
+    toccata_wavetable_t tables[TOCCATA_NUM_DIVISIONS][TOCCATA_NUM_KEYS];
+};
+
+struct toccata_synth_t {
+    float sample_rate;
+    int samples_per_block;
+    float volume;
+
+    // Voices run at `render_rate`, and are decimated to the sample rate
+    // when oversampled
+    int oversampling;
+    int target_oversampling;
+    float render_rate;
+    float decimator_mix; ///< From plain decimation at 0 to the filtered one at 1
+    int decimator_warmup; ///< Frames before the filter output is valid
+    float delay_lines[NUM_OUTPUT_CHANNELS][TOCCATA_DECIMATOR_DELAY]; ///< Delay of the rendering at the sample rate
+
+    // Segments of exactly `fixed_block_size` frames use specialized kernels
+    int fixed_block_size;
+    toccata_mix_function_t fixed_mix;
+    toccata_mix_ramp_function_t fixed_mix_ramp;
+
+    toccata_wavetable_t tables[TOCCATA_NUM_RANKS][TOCCATA_TABLES_PER_RANK];
+    toccata_wavetable_t crossfades[TOCCATA_NUM_RANKS][TOCCATA_NUM_KEYS]; ///< Blends for the keys between two tables
+    toccata_wavetable_t attack_tables[TOCCATA_NUM_RANKS][TOCCATA_TABLES_PER_RANK];
+    toccata_wavetable_t attack_crossfades[TOCCATA_NUM_RANKS][TOCCATA_NUM_KEYS];
+    toccata_pipe_t pipes[TOCCATA_NUM_RANKS][TOCCATA_NUM_KEYS];
+    float layout_gains[TOCCATA_NUM_LAYOUTS][TOCCATA_NUM_KEYS][NUM_CHANNELS]; ///< Constant-power pan of each key
+    float stop_gains[TOCCATA_NUM_STOPS]; ///< Targets of the bus gains
+    float drawn_gains[TOCCATA_NUM_STOPS]; ///< From the stop ports and CCs, before the crescendo
+    int crescendo_step;
+    int rank_outputs[TOCCATA_NUM_RANKS];
+    bool outputs_used[TOCCATA_NUM_OUTPUTS]; ///< The main output, and those with ranks
+    int rank_qualities[TOCCATA_NUM_RANKS];
+
+    // Stop gain changes are linear ramps of the bus gains
+    float gain_smoothing; ///< In seconds
+    float bus_gains[TOCCATA_NUM_STOPS];
+    float gain_steps[TOCCATA_NUM_STOPS];
+    int gain_frames[TOCCATA_NUM_STOPS]; ///< Left in the current ramp
+
+    // The tremulant shakes the wind of all the pipes together, so it is
+    // one amplitude ramp on the outputs and one pitch ratio per segment
+    float tremulant_rate; ///< In Hz
+    float tremulant_depth; ///< From 0 to 1
+    double tremulant_phase; ///< In periods
+    float tremulant_level; ///< Amplitude at the end of the last segment
+
+    // The held pipes of each division lower its wind pressure, which scales
+    // the gain and pitch of its voices once per segment
+    bool wind_model;
+    float wind_pressures[TOCCATA_NUM_DIVISIONS]; ///< Fraction of the nominal pressure
+
+    // The enclosed division sounds through the swell box, a lowpass and a
+    // gain on its buses, with coefficients updated once per segment
+    float swell_target; ///< Expression, from closed at 0 to open at 1
+    float swell; ///< Opening of the shutters
+    float swell_gain; ///< At the end of the last segment
+    float swell_states[TOCCATA_NUM_OUTPUTS][NUM_CHANNELS]; ///< Last outputs of the lowpass
+
+    // The phase of the pipes of each key, as a fraction of the period of
+    // the key frequency, which is the one of the lowest rank. Each division
+    // has its own, since the wind bends their pitch apart.
+    float key_frequencies[TOCCATA_NUM_KEYS];
+    uint32_t key_phases[TOCCATA_NUM_DIVISIONS][TOCCATA_NUM_KEYS];
+    uint32_t key_increments[TOCCATA_NUM_KEYS];
+
+    toccata_registration_t* registration;
+    bool merge_pending[TOCCATA_NUM_DIVISIONS][TOCCATA_NUM_KEYS];
+
+    /**
+       One voice per (stop, key, zone) and one attack transient per
+       (stop, key), so that starting a pipe is an index, then one merged
+       voice per (division, key), followed by the overflow voices that play
+       the release tails of repeated notes.
+    */
+    toccata_voice_t* voices;
+    int num_voices;
+    int* active_voices; ///< Indices of the voices to render
+    int num_active_voices;
+    bool voices_locked;
+    bool active_voices_locked;
+    uint32_t next_age;
+
+    float* stop_buses; ///< One stereo bus of `samples_per_block` frames per stop, and the merged buses
+    float* envelope; ///< One buffer of `samples_per_block` frames per render thread
+    float* oversampled; ///< One decimator history and segment per output channel
+    bool stop_buses_locked;
+    bool envelope_locked;
+    bool oversampled_locked;
+
+    // Voices are rendered by bus on the threads of the pool
+    toccata_pool_t* pool;
+    int num_render_threads;
+    int bus_voices[NUM_BUSES]; ///< Voices left on each bus after the last segment
+
+    toccata_event_t events[MAX_EVENTS];
+    int num_events;
+
+    // Each division has its own keyboard
+    bool keys_down[TOCCATA_NUM_DIVISIONS][128];
+    bool keys_sustained[TOCCATA_NUM_DIVISIONS][128]; ///< Released while the sustain pedal is down
+    bool sustain_pedal[TOCCATA_NUM_DIVISIONS];
+    bool memory_locked; ///< New buffers are locked too, until toccata_synth_unlock_memory()
+};
+
+toccata_synth_t*
+toccata_synth_create(void)
+{
+    toccata_synth_t* synth = (toccata_synth_t*)calloc(1, sizeof(toccata_synth_t));
+    if (!synth)
+        return NULL;
+
+    synth->sample_rate = 48000.0f;
+    synth->oversampling = 1;
+    synth->target_oversampling = 1;
+    synth->num_render_threads = 1;
+    synth->render_rate = synth->sample_rate;
+    synth->outputs_used[0] = true;
+    synth->volume = powf(10.0f, TOCCATA_VOLUME_DB / 20.0f);
+    synth->tremulant_rate = DEFAULT_TREMULANT_RATE;
+    synth->tremulant_level = 1.0f;
+    for (int division = 0; division < TOCCATA_NUM_DIVISIONS; ++division)
+        synth->wind_pressures[division] = 1.0f;
+    synth->swell_target = 1.0f;
+    synth->swell = 1.0f;
+    synth->swell_gain = 1.0f;
+    for (int rank = 0; rank < TOCCATA_NUM_RANKS; ++rank)
+        synth->rank_qualities[rank] = TOCCATA_QUALITY_LINEAR;
+    return synth;
+}
+
+void
+toccata_synth_free(toccata_synth_t* synth)
+{
+    if (!synth)
+        return;
+
+    toccata_synth_unlock_memory(synth);
+    for (int rank = 0; rank < TOCCATA_NUM_RANKS; ++rank) {
+        for (int table = 0; table < TOCCATA_TABLES_PER_RANK; ++table)
+            toccata_wavetable_free(&synth->tables[rank][table]);
+        for (int k = 0; k < TOCCATA_NUM_KEYS; ++k)
+            toccata_wavetable_free(&synth->crossfades[rank][k]);
+        for (int table = 0; table < TOCCATA_TABLES_PER_RANK; ++table)
+            toccata_wavetable_free(&synth->attack_tables[rank][table]);
+        for (int k = 0; k < TOCCATA_NUM_KEYS; ++k)
+            toccata_wavetable_free(&synth->attack_crossfades[rank][k]);
+    }
+    toccata_synth_free_registration(synth->registration);
+    free(synth->voices);
+    free(synth->active_voices);
+    free(synth->stop_buses);
+    free(synth->envelope);
+    free(synth->oversampled);
+    free(synth);
+}
+
+static float
+crossfade_in(int key, int lokey, int hikey)
+{
+    if (lokey == 0 && hikey == 0)
+        return 1.0f;
+    if (key < lokey)
+        return 0.0f;
+    if (key >= hikey)
+        return 1.0f;
+    return sqrtf((float)(key - lokey) / (hikey - lokey));
+}
+
+static float
+crossfade_out(int key, int lokey, int hikey)
+{
+    if (lokey == 0 && hikey == 0)
+        return 1.0f;
+    if (key > hikey)
+        return 0.0f;
+    if (key <= lokey)
+        return 1.0f;
+    return sqrtf((float)(hikey - key) / (hikey - lokey));
+}
+
+/**
+   Find the tables of a rank that sound on a key, and their crossfade
+   gain. Keys between two tables play a blend of both, built in `blend`.
+   The zone has no table if none covers the key.
+*/
+static bool
+resolve_zone(const toccata_wavetable_t* tables, toccata_wavetable_t* blend,
+    const toccata_table_zone_t* zones, const float* sustain, int key, toccata_zone_t* pipe_zone)
+{
+    const toccata_wavetable_t* sources[2];
+    float gains[2];
+    float sustains[2];
+    int num_sources = 0;
+    for (int table = 0; table < TOCCATA_TABLES_PER_RANK; ++table) {
+        const toccata_table_zone_t* zone = &zones[table];
+        if (key < zone->lokey || key > zone->hikey)
+            continue;
+
+        const float gain = crossfade_in(key, zone->xfin_lokey, zone->xfin_hikey)
+            * crossfade_out(key, zone->xfout_lokey, zone->xfout_hikey);
+        if (gain <= 0.0f || num_sources == 2)
+            continue;
+
+        sources[num_sources] = &tables[table];
+        gains[num_sources] = gain;
+        sustains[num_sources] = sustain[table];
+        num_sources++;
+    }
+
+    pipe_zone->table = NULL;
+    if (num_sources == 1) {
+        pipe_zone->table = sources[0];
+        pipe_zone->gain = gains[0];
+        pipe_zone->sustain = sustains[0];
+    } else if (num_sources == 2) {
+        // The blend sustains at the sum of both tables, and only peaks a
+        // little off when their sustain levels differ
+        const float sustain = (gains[0] * sustains[0] + gains[1] * sustains[1]) / (gains[0] + gains[1]);
+        const float weights[2] = {
+            gains[0] * sustains[0] / sustain,
+            gains[1] * sustains[1] / sustain
+        };
+        if (!toccata_wavetable_blend(blend, sources, weights, 2))
+            return false;
+        pipe_zone->table = blend;
+        pipe_zone->gain = 1.0f;
+        pipe_zone->sustain = sustain;
+    }
+    return true;
+}
+
+/**
+   Pan of a key, from -1 on the left to 1 on the right. On the sides, the
+   keys of the whole-tone scale from C stand on the left and the others on
+   the right, each side with its largest pipes outside.
+*/
+static float
+layout_pan(int layout, int key)
+{
+    if (layout != TOCCATA_LAYOUT_SIDES)
+        return 0.0f;
+
+    const float size = 1.0f - (float)(key - TOCCATA_LOWEST_KEY) / (float)(TOCCATA_NUM_KEYS - 1);
+    const float pan = INNER_PIPE_PAN + size * (OUTER_PIPE_PAN - INNER_PIPE_PAN);
+    return key % 2 == 0 ? -pan : pan;
+}
+
+static void
+update_key_increments(toccata_synth_t* synth)
+{
+    for (int k = 0; k < TOCCATA_NUM_KEYS; ++k)
+        synth->key_increments[k] = (uint32_t)(synth->key_frequencies[k] / synth->render_rate * PHASE_SCALE);
+}
+
+bool
+toccata_synth_load(toccata_synth_t* synth, const char* directory, const toccata_voicing_t* voicing)
+{
+    char path[MAX_PATH_SIZE];
+
+    for (int rank = 0; rank < TOCCATA_NUM_RANKS; ++rank) {
+        for (int table = 0; table < TOCCATA_TABLES_PER_RANK; ++table) {
+            snprintf(path, MAX_PATH_SIZE, "%stable_%s_c%d_sustain.wav",
+                directory, toccata_ranks[rank].tables, voicing->zones[table].octave);
+            if (!toccata_wavetable_load(&synth->tables[rank][table], path))
+                return false;
+        }
+    }
+
+    // Attack tables are optional: ranks without them start on their
+    // sustain tables
+    bool has_attack[TOCCATA_NUM_RANKS];
+    for (int rank = 0; rank < TOCCATA_NUM_RANKS; ++rank) {
+        has_attack[rank] = true;
+        for (int table = 0; table < TOCCATA_TABLES_PER_RANK && has_attack[rank]; ++table) {
+            snprintf(path, MAX_PATH_SIZE, "%stable_%s_c%d_attack.wav",
+                directory, toccata_ranks[rank].tables, voicing->zones[table].octave);
+            has_attack[rank] = toccata_wavetable_load(&synth->attack_tables[rank][table], path);
+        }
+    }
+
+    // The key frequency is the one of the lowest rank; ranks an exact
+    // number of octaves above it can be merged
+    int lowest_transpose = toccata_ranks[0].transpose;
+    for (int rank = 1; rank < TOCCATA_NUM_RANKS; ++rank) {
+        if (toccata_ranks[rank].transpose < lowest_transpose)
+            lowest_transpose = toccata_ranks[rank].transpose;
+    }
+    for (int k = 0; k < TOCCATA_NUM_KEYS; ++k)
+        synth->key_frequencies[k] = 440.0f * powf(2.0f, (TOCCATA_LOWEST_KEY + k + lowest_transpose - 69) / 12.0f);
+    update_key_increments(synth);
+
+    // Constant-power pans, at unity gain in the middle so that centered
+    // pipes sound as loud as before they were placed
+    for (int layout = 0; layout < TOCCATA_NUM_LAYOUTS; ++layout) {
+        for (int k = 0; k < TOCCATA_NUM_KEYS; ++k) {
+            const float angle = (layout_pan(layout, TOCCATA_LOWEST_KEY + k) + 1.0f) * (float)M_PI * 0.25f;
+            synth->layout_gains[layout][k][0] = sqrtf(2.0f) * cosf(angle);
+            synth->layout_gains[layout][k][1] = sqrtf(2.0f) * sinf(angle);
+        }
+    }
+
+    // Resolve which tables sound on each key, and at which gain
+    for (int rank = 0; rank < TOCCATA_NUM_RANKS; ++rank) {
+        const toccata_rank_t* desc = &toccata_ranks[rank];
+        const int interval = desc->transpose - lowest_transpose;
+        for (int k = 0; k < TOCCATA_NUM_KEYS; ++k) {
+            const int key = TOCCATA_LOWEST_KEY + k;
+            toccata_pipe_t* pipe = &synth->pipes[rank][k];
+            pipe->frequency = 440.0f * powf(2.0f, (key + desc->transpose - 69) / 12.0f);
+            pipe->multiplier = interval % 12 == 0 && interval / 12 < 8 ? 1 << (interval / 12) : 0;
+            pipe->wind = sqrtf(WIND_REFERENCE_FREQUENCY / pipe->frequency);
+            pipe->attack = voicing->attack[rank][k];
+            pipe->decay = voicing->decay[rank][k];
+            pipe->pan_gains = synth->layout_gains[desc->layout][k];
+
+            if (!resolve_zone(synth->tables[rank], &synth->crossfades[rank][k],
+                    voicing->zones, voicing->sustain[rank], key, &pipe->zones[0]))
+                return false;
+            pipe->num_zones = pipe->zones[0].table ? 1 : 0;
+
+            pipe->attack_zone.table = NULL;
+            if (has_attack[rank] && !resolve_zone(synth->attack_tables[rank], &synth->attack_crossfades[rank][k],
+                    voicing->zones, voicing->sustain[rank], key, &pipe->attack_zone))
+                return false;
+        }
+    }
+
+    return true;
+}
+
+bool
+toccata_synth_set_num_overflow_voices(toccata_synth_t* synth, int num_overflow_voices)
+{
+    const int num_voices = NUM_FIXED_VOICES + num_overflow_voices;
+    toccata_voice_t* voices = (toccata_voice_t*)calloc(num_voices, sizeof(toccata_voice_t));
+    int* active_voices = (int*)calloc(num_voices, sizeof(int));
+    if (!voices || !active_voices) {
+        free(voices);
+        free(active_voices);
+        return false;
+    }
+
+    toccata_unlock_buffer(synth->voices, synth->num_voices * sizeof(toccata_voice_t), &synth->voices_locked);
+    toccata_unlock_buffer(synth->active_voices, synth->num_voices * sizeof(int), &synth->active_voices_locked);
+    free(synth->voices);
+    free(synth->active_voices);
+    synth->voices = voices;
+    synth->active_voices = active_voices;
+    synth->num_voices = num_voices;
+    synth->num_active_voices = 0;
+    if (synth->memory_locked) {
+        toccata_lock_buffer(synth->voices, synth->num_voices * sizeof(toccata_voice_t), &synth->voices_locked);
+        toccata_lock_buffer(synth->active_voices, synth->num_voices * sizeof(int), &synth->active_voices_locked);
+    }
+    return true;
+}
+
+void
+toccata_synth_set_sample_rate(toccata_synth_t* synth, float sample_rate)
+{
+    // Phase increments and envelope rates are computed when voices start
+    toccata_synth_all_sound_off(synth);
+    synth->sample_rate = sample_rate;
+    synth->render_rate = sample_rate * (float)synth->oversampling;
+    update_key_increments(synth);
+}
+
+bool
+toccata_synth_set_samples_per_block(toccata_synth_t* synth, int samples_per_block)
+{
+    toccata_synth_buffers_t* buffers = toccata_synth_create_buffers(samples_per_block, synth->memory_locked);
+    if (!buffers)
+        return false;
+
+    toccata_synth_free_buffers(toccata_synth_swap_buffers(synth, buffers));
+    return true;
+}
+
+toccata_synth_buffers_t*
+toccata_synth_create_buffers(int samples_per_block, bool lock)
+{
+    toccata_synth_buffers_t* buffers = (toccata_synth_buffers_t*)calloc(1, sizeof(toccata_synth_buffers_t));
+    if (!buffers)
+        return NULL;
+
+    // Oversampled segments are half a block, so that they fit the buses
+    samples_per_block += samples_per_block % TOCCATA_MAX_OVERSAMPLING;
+    buffers->samples_per_block = samples_per_block;
+    buffers->stop_buses = (float*)calloc(1, STOP_BUSES_SIZE(samples_per_block));
+    buffers->envelope = (float*)calloc(1, ENVELOPE_SIZE(samples_per_block));
+    buffers->oversampled = (float*)calloc(1, OVERSAMPLED_SIZE(samples_per_block));
+    if (!buffers->stop_buses || !buffers->envelope || !buffers->oversampled) {
+        toccata_synth_free_buffers(buffers);
+        return NULL;
+    }
+
+    if (lock) {
+        toccata_lock_buffer(buffers->stop_buses, STOP_BUSES_SIZE(samples_per_block), &buffers->stop_buses_locked);
+        toccata_lock_buffer(buffers->envelope, ENVELOPE_SIZE(samples_per_block), &buffers->envelope_locked);
+        toccata_lock_buffer(buffers->oversampled, OVERSAMPLED_SIZE(samples_per_block), &buffers->oversampled_locked);
+    }
+    return buffers;
+}
+
+void
+toccata_synth_free_buffers(toccata_synth_buffers_t* buffers)
+{
+    if (!buffers)
+        return;
+
+    toccata_unlock_buffer(buffers->stop_buses, STOP_BUSES_SIZE(buffers->samples_per_block), &buffers->stop_buses_locked);
+    toccata_unlock_buffer(buffers->envelope, ENVELOPE_SIZE(buffers->samples_per_block), &buffers->envelope_locked);
+    toccata_unlock_buffer(buffers->oversampled, OVERSAMPLED_SIZE(buffers->samples_per_block),
+        &buffers->oversampled_locked);
+    free(buffers->stop_buses);
+    free(buffers->envelope);
+    free(buffers->oversampled);
+    free(buffers);
+}
+
+toccata_synth_buffers_t*
+toccata_synth_swap_buffers(toccata_synth_t* synth, toccata_synth_buffers_t* buffers)
+{
+    toccata_synth_buffers_t old = {
+        synth->samples_per_block,
+        synth->stop_buses,
+        synth->envelope,
+        synth->oversampled,
+        synth->stop_buses_locked,
+        synth->envelope_locked,
+        synth->oversampled_locked
+    };
+
+    // The decimators carry on in the new buffers
+    if (synth->oversampled) {
+        for (int channel = 0; channel < NUM_OUTPUT_CHANNELS; ++channel) {
+            memcpy(buffers->oversampled + channel * OVERSAMPLED_FRAMES(buffers->samples_per_block),
+                synth->oversampled + channel * OVERSAMPLED_FRAMES(synth->samples_per_block),
+                TOCCATA_DECIMATOR_HISTORY * sizeof(float));
+        }
+    }
+
+    synth->samples_per_block = buffers->samples_per_block;
+    synth->stop_buses = buffers->stop_buses;
+    synth->envelope = buffers->envelope;
+    synth->oversampled = buffers->oversampled;
+    synth->stop_buses_locked = buffers->stop_buses_locked;
+    synth->envelope_locked = buffers->envelope_locked;
+    synth->oversampled_locked = buffers->oversampled_locked;
+    *buffers = old;
+    return buffers;
+}
+
+static void
+queue_event(toccata_synth_t* synth, int delay, toccata_event_type_t type, int division, int number, float value)
+{
+    if (synth->num_events == MAX_EVENTS)
+        return;
+
+    // Keep the queue sorted by delay, in arrival order for equal delays
+    int i = synth->num_events++;
+    delay = delay < 0 ? 0 : delay;
+    for (; i > 0 && synth->events[i - 1].delay > delay; --i)
+        synth->events[i] = synth->events[i - 1];
+
+    synth->events[i].delay = delay;
+    synth->events[i].type = type;
+    synth->events[i].division = division;
+    synth->events[i].number = number;
+    synth->events[i].value = value;
+}
+
+void
+toccata_synth_note_on(toccata_synth_t* synth, int delay, int division, int key, int velocity)
+{
+    // Organ pipes do not respond to velocity
+    (void)velocity;
+    queue_event(synth, delay, EVENT_NOTE_ON, division, key, 0.0f);
+}
+
+void
+toccata_synth_note_off(toccata_synth_t* synth, int delay, int division, int key, int velocity)
+{
+    (void)velocity;
+    queue_event(synth, delay, EVENT_NOTE_OFF, division, key, 0.0f);
+}
+
+void
+toccata_synth_cc(toccata_synth_t* synth, int delay, int division, int cc, int value)
+{
+    queue_event(synth, delay, EVENT_CC, division, cc, value / 127.0f);
+}
+
+void
+toccata_synth_set_swell(toccata_synth_t* synth, int delay, float value)
+{
+    queue_event(synth, delay, EVENT_CC, TOCCATA_ENCLOSED_DIVISION, EXPRESSION_CC, value);
+}
+
+void
+toccata_synth_set_crescendo(toccata_synth_t* synth, int delay, float value)
+{
+    queue_event(synth, delay, EVENT_CC, TOCCATA_DIVISION_GREAT, CRESCENDO_CC, value);
+}
+
+void
+toccata_synth_set_stop_gain(toccata_synth_t* synth, int delay, int stop, float gain)
+{
+    queue_event(synth, delay, EVENT_STOP_GAIN, stop / TOCCATA_NUM_RANKS, stop, gain);
+}
+
+void
+toccata_synth_all_sound_off(toccata_synth_t* synth)
+{
+    for (int i = 0; i < synth->num_voices; ++i) {
+        synth->voices[i].active = false;
+        synth->voices[i].listed = false;
+    }
+    synth->num_active_voices = 0;
+}
+
+void
+toccata_synth_copy_state(toccata_synth_t* synth, const toccata_synth_t* source)
+{
+    for (int stop = 0; stop < TOCCATA_NUM_STOPS; ++stop) {
+        synth->stop_gains[stop] = source->stop_gains[stop];
+        synth->drawn_gains[stop] = source->drawn_gains[stop];
+        synth->bus_gains[stop] = source->bus_gains[stop];
+        synth->gain_steps[stop] = source->gain_steps[stop];
+        synth->gain_frames[stop] = source->gain_frames[stop];
+    }
+    synth->gain_smoothing = source->gain_smoothing;
+    synth->crescendo_step = source->crescendo_step;
+    synth->tremulant_rate = source->tremulant_rate;
+    synth->tremulant_depth = source->tremulant_depth;
+    synth->tremulant_phase = source->tremulant_phase;
+    synth->tremulant_level = source->tremulant_level;
+    synth->wind_model = source->wind_model;
+    memcpy(synth->wind_pressures, source->wind_pressures, sizeof(synth->wind_pressures));
+    synth->swell_target = source->swell_target;
+    synth->swell = source->swell;
+    synth->swell_gain = source->swell_gain;
+    memcpy(synth->swell_states, source->swell_states, sizeof(synth->swell_states));
+    synth->target_oversampling = source->target_oversampling;
+    memcpy(synth->rank_qualities, source->rank_qualities, sizeof(synth->rank_qualities));
+    for (int rank = 0; rank < TOCCATA_NUM_RANKS; ++rank)
+        toccata_synth_set_rank_output(synth, rank, source->rank_outputs[rank]);
+    memcpy(synth->sustain_pedal, source->sustain_pedal, sizeof(synth->sustain_pedal));
+
+    bool sustained[TOCCATA_NUM_DIVISIONS][128] = { { false } };
+    for (int i = 0; i < source->num_voices; ++i) {
+        const toccata_voice_t* voice = &source->voices[i];
+        if (voice->active && voice->sustained)
+            sustained[voice->division][voice->key] = true;
+    }
+
+    for (int division = 0; division < TOCCATA_NUM_DIVISIONS; ++division) {
+        for (int key = 0; key < 128; ++key) {
+            const bool down = source->keys_down[division][key];
+            if (down || sustained[division][key])
+                queue_event(synth, 0, EVENT_NOTE_ON, division, key, 0.0f);
+            if (!down && sustained[division][key])
+                queue_event(synth, 0, EVENT_NOTE_OFF, division, key, 0.0f);
+        }
+    }
+}
+
+int
+toccata_synth_get_num_active_voices(const toccata_synth_t* synth)
+{
+    int count = 0;
+    for (int i = 0; i < synth->num_active_voices; ++i)
+        count += synth->voices[synth->active_voices[i]].active;
+    return count;
+}
+
+static toccata_voice_t*
+pipe_voice(toccata_synth_t* synth, int stop, int key, int zone)
+{
+    const int pipe = stop * TOCCATA_NUM_KEYS + key - TOCCATA_LOWEST_KEY;
+    return &synth->voices[pipe * VOICES_PER_PIPE + zone];
+}
+
+static toccata_voice_t*
+attack_voice(toccata_synth_t* synth, int stop, int key)
+{
+    return pipe_voice(synth, stop, key, MAX_ZONES);
+}
+
+static toccata_voice_t*
+merged_voice(toccata_synth_t* synth, int division, int key)
+{
+    return &synth->voices[NUM_PIPE_VOICES + division * TOCCATA_NUM_KEYS + key - TOCCATA_LOWEST_KEY];
+}
+
+static void
+activate_voice(toccata_synth_t* synth, toccata_voice_t* voice)
+{
+    voice->active = true;
+    if (!voice->listed) {
+        voice->listed = true;
+        synth->active_voices[synth->num_active_voices++] = (int)(voice - synth->voices);
+    }
+}
+
+/**
+   Find an overflow voice for a release tail: a free one if possible,
+   otherwise the oldest tail. Only release tails ever get stolen.
+*/
+static toccata_voice_t*
+overflow_voice(toccata_synth_t* synth)
+{
+    toccata_voice_t* candidate = NULL;
+    for (int i = NUM_FIXED_VOICES; i < synth->num_voices; ++i) {
+        toccata_voice_t* voice = &synth->voices[i];
+        if (!voice->active)
+            return voice;
+
+        if (!candidate || (int32_t)(voice->age - candidate->age) < 0)
+            candidate = voice;
+    }
+    return candidate;
+}
+
+static void
+release_voice(toccata_voice_t* voice)
+{
+    voice->sustained = false;
+    voice->stage = STAGE_RELEASE;
+}
+
+/**
+   Move a sounding voice to an overflow voice, where it releases.
+*/
+static void
+retire_voice(toccata_synth_t* synth, toccata_voice_t* voice)
+{
+    toccata_voice_t* tail = overflow_voice(synth);
+    if (tail && tail != voice) {
+        const bool listed = tail->listed;
+        *tail = *voice;
+        tail->listed = listed;
+        release_voice(tail);
+        activate_voice(synth, tail);
+    }
+    voice->active = false;
+}
+
+static uint32_t
+pipe_increment(const toccata_synth_t* synth, const toccata_pipe_t* pipe, int k)
+{
+    // Locked to the key phase, so that the pipe can be merged
+    if (pipe->multiplier > 0)
+        return (uint32_t)pipe->multiplier * synth->key_increments[k];
+    return (uint32_t)(pipe->frequency / synth->render_rate * PHASE_SCALE);
+}
+
+static const toccata_pipe_t*
+stop_pipe(const toccata_synth_t* synth, int stop, int key)
+{
+    return &synth->pipes[stop % TOCCATA_NUM_RANKS][key - TOCCATA_LOWEST_KEY];
+}
+
+static void
+init_voice(toccata_synth_t* synth, toccata_voice_t* voice, int stop, int key, const toccata_pipe_t* pipe,
+    const toccata_zone_t* zone)
+{
+    const int k = key - TOCCATA_LOWEST_KEY;
+    const float sample_rate = synth->render_rate;
+    activate_voice(synth, voice);
+    voice->sustained = false;
+    voice->stop = stop;
+    voice->division = stop / TOCCATA_NUM_RANKS;
+    voice->key = key;
+    voice->age = synth->next_age++;
+    // Harmonics stay below the output Nyquist frequency, even when oversampled
+    voice->mip = toccata_wavetable_select(zone->table, pipe->frequency, synth->sample_rate);
+    voice->phase = pipe->multiplier > 0 ? (uint32_t)pipe->multiplier * synth->key_phases[voice->division][k] : 0;
+    voice->phase_increment = pipe_increment(synth, pipe, k);
+    voice->multiplier = pipe->multiplier;
+    voice->gains[0] = zone->gain * synth->volume * pipe->pan_gains[0];
+    voice->gains[1] = zone->gain * synth->volume * pipe->pan_gains[1];
+    voice->wind = pipe->wind * synth->stop_gains[stop];
+
+    // Without a decay the attack goes straight to the sustain level
+    voice->stage = STAGE_ATTACK;
+    voice->level = 0.0f;
+    voice->sustain = zone->sustain;
+    voice->peak = pipe->decay > 0.0f ? 1.0f : zone->sustain;
+    voice->attack_step = voice->peak / fmaxf(1.0f, pipe->attack * sample_rate);
+    voice->decay_rate = pipe->decay > 0.0f ? expf(logf(EXPONENTIAL_TARGET) / (pipe->decay * sample_rate)) : 0.0f;
+    voice->release_rate = expf(logf(EXPONENTIAL_TARGET) / (TOCCATA_RELEASE_TIME * sample_rate));
+    voice->fade = 1.0f;
+    voice->fade_step = 0.0f;
+}
+
+static toccata_voice_t*
+start_voice(toccata_synth_t* synth, int stop, int key, const toccata_pipe_t* pipe, int zone_index)
+{
+    toccata_voice_t* voice = pipe_voice(synth, stop, key, zone_index);
+
+    // A pipe that is still sounding keeps releasing in an overflow voice
+    if (voice->active)
+        retire_voice(synth, voice);
+
+    init_voice(synth, voice, stop, key, pipe, &pipe->zones[zone_index]);
+    return voice;
+}
+
+static void
+start_pipe(toccata_synth_t* synth, int stop, int key)
+{
+    const int division = stop / TOCCATA_NUM_RANKS;
+    const toccata_pipe_t* pipe = stop_pipe(synth, stop, key);
+    const bool sustained = synth->keys_sustained[division][key];
+
+    // The attack transient crossfades into the pipe over its attack
+    const float fade_step = pipe->attack_zone.table ? 1.0f / fmaxf(1.0f, pipe->attack * synth->render_rate) : 0.0f;
+    for (int zone = 0; zone < pipe->num_zones; ++zone) {
+        toccata_voice_t* voice = start_voice(synth, stop, key, pipe, zone);
+        voice->sustained = sustained;
+        if (fade_step > 0.0f) {
+            voice->fade = 0.0f;
+            voice->fade_step = fade_step;
+        }
+    }
+
+    if (fade_step > 0.0f) {
+        toccata_voice_t* voice = attack_voice(synth, stop, key);
+        if (voice->active)
+            retire_voice(synth, voice);
+        init_voice(synth, voice, stop, key, pipe, &pipe->attack_zone);
+        voice->sustained = sustained;
+        voice->fade_step = -fade_step;
+        voice->wind = 0.0f;
+    }
+    synth->merge_pending[division][key - TOCCATA_LOWEST_KEY] = true;
+}
+
+/**
+   Replace the pipe voices of a key of a division by its merged voice,
+   once they all reached their sustain level with the gains of the
+   registration. Returns false if the key should be tried again later.
+*/
+static bool
+merge_pipes(toccata_synth_t* synth, int division, int key)
+{
+    const toccata_registration_t* registration = synth->registration;
+    const int k = key - TOCCATA_LOWEST_KEY;
+    toccata_voice_t* merged = merged_voice(synth, division, key);
+    if (merged->active && merged->stage != STAGE_RELEASE)
+        return true;
+    if (registration->tables[division][k].num_mips == 0)
+        return true;
+
+    const int first_stop = division * TOCCATA_NUM_RANKS;
+    for (int stop = first_stop; stop < first_stop + TOCCATA_NUM_RANKS; ++stop) {
+        if (!registration->merged[stop])
+            continue;
+        if (synth->stop_gains[stop] != registration->stop_gains[stop] || synth->gain_frames[stop] > 0)
+            return false;
+        if (synth->rank_outputs[stop % TOCCATA_NUM_RANKS] != registration->output)
+            return false;
+
+        const toccata_pipe_t* pipe = stop_pipe(synth, stop, key);
+        for (int zone = 0; zone < pipe->num_zones; ++zone) {
+            const toccata_voice_t* voice = pipe_voice(synth, stop, key, zone);
+            if (!voice->active || voice->stage != STAGE_SUSTAIN || voice->fade_step != 0.0f)
+                return false;
+        }
+        if (attack_voice(synth, stop, key)->active)
+            return false;
+    }
+
+    bool sustained = false;
+    float wind = 0.0f;
+    for (int stop = first_stop; stop < first_stop + TOCCATA_NUM_RANKS; ++stop) {
+        if (!registration->merged[stop])
+            continue;
+
+        const toccata_pipe_t* pipe = stop_pipe(synth, stop, key);
+        wind += pipe->wind * synth->stop_gains[stop];
+        for (int zone = 0; zone < pipe->num_zones; ++zone) {
+            toccata_voice_t* voice = pipe_voice(synth, stop, key, zone);
+            sustained = voice->sustained;
+            voice->active = false;
+        }
+    }
+
+    if (merged->active)
+        retire_voice(synth, merged);
+
+    activate_voice(synth, merged);
+    merged->sustained = sustained;
+    merged->stop = MERGED_BUS;
+    merged->division = division;
+    merged->key = key;
+    merged->age = synth->next_age++;
+    merged->mip = toccata_wavetable_select(&registration->tables[division][k], synth->key_frequencies[k], synth->sample_rate);
+    merged->phase = synth->key_phases[division][k];
+    merged->phase_increment = synth->key_increments[k];
+    merged->multiplier = 1;
+    merged->gains[0] = synth->volume * synth->layout_gains[registration->layout][k][0];
+    merged->gains[1] = synth->volume * synth->layout_gains[registration->layout][k][1];
+    merged->wind = wind;
+    merged->stage = STAGE_SUSTAIN;
+    merged->level = 1.0f;
+    merged->sustain = 1.0f;
+    merged->peak = 1.0f;
+    merged->attack_step = 0.0f;
+    merged->decay_rate = 0.0f;
+    merged->release_rate = expf(logf(EXPONENTIAL_TARGET) / (TOCCATA_RELEASE_TIME * synth->render_rate));
+    merged->fade = 1.0f;
+    merged->fade_step = 0.0f;
+    return true;
+}
+
+/**
+   Replace a merged voice by the pipe voices it stands for, at the same
+   stage and level. Release tails are expanded into overflow voices.
+*/
+static void
+expand_merged_voice(toccata_synth_t* synth, toccata_voice_t* merged)
+{
+    const toccata_registration_t* registration = synth->registration;
+    const int division = merged->division;
+    const int key = merged->key;
+    const toccata_stage_t stage = merged->stage;
+    const float level = merged->level;
+    const bool sustained = merged->sustained;
+    merged->active = false;
+
+    const int first_stop = division * TOCCATA_NUM_RANKS;
+    for (int stop = first_stop; stop < first_stop + TOCCATA_NUM_RANKS; ++stop) {
+        if (!registration->merged[stop])
+            continue;
+
+        const toccata_pipe_t* pipe = stop_pipe(synth, stop, key);
+        for (int zone = 0; zone < pipe->num_zones; ++zone) {
+            toccata_voice_t* voice;
+            if (stage == STAGE_RELEASE) {
+                voice = overflow_voice(synth);
+                if (!voice)
+                    continue;
+                init_voice(synth, voice, stop, key, pipe, &pipe->zones[zone]);
+            } else {
+                voice = start_voice(synth, stop, key, pipe, zone);
+            }
+            voice->stage = stage;
+            voice->level = level * pipe->zones[zone].sustain;
+            voice->sustained = sustained;
+        }
+    }
+
+    if (stage != STAGE_RELEASE)
+        synth->merge_pending[division][key - TOCCATA_LOWEST_KEY] = true;
+}
+
+/**
+   Expand the merged voices, either all of them or only those still held.
+*/
+static void
+expand_merged_voices(toccata_synth_t* synth, bool tails)
+{
+    if (!synth->registration)
+        return;
+
+    // Expanding adds voices at the end of the list, which are not merged
+    const int num_active_voices = synth->num_active_voices;
+    for (int i = 0; i < num_active_voices; ++i) {
+        toccata_voice_t* voice = &synth->voices[synth->active_voices[i]];
+        if (voice->active && voice->stop == MERGED_BUS && (tails || voice->stage != STAGE_RELEASE))
+            expand_merged_voice(synth, voice);
+    }
+}
+
+static int
+ceil_log2(int value)
+{
+    int bits = 0;
+    while ((1 << bits) < value)
+        ++bits;
+    return bits;
+}
+
+toccata_registration_t*
+toccata_synth_create_registration(const toccata_synth_t* synth, const float* stop_gains,
+    const int* rank_outputs, bool lock)
+{
+    toccata_registration_t* registration = (toccata_registration_t*)calloc(1, sizeof(toccata_registration_t));
+    double* real = (double*)malloc((MAX_MERGED_HARMONICS + 1) * sizeof(double));
+    double* imag = (double*)malloc((MAX_MERGED_HARMONICS + 1) * sizeof(double));
+    if (!registration || !real || !imag) {
+        free(registration);
+        free(real);
+        free(imag);
+        return NULL;
+    }
+
+    // Only the ranks of one output and one layout can share tables, those
+    // with the most drawn stops
+    int drawn[TOCCATA_NUM_OUTPUTS][TOCCATA_NUM_LAYOUTS] = { { 0 } };
+    memcpy(registration->stop_gains, stop_gains, sizeof(registration->stop_gains));
+    memcpy(registration->rank_outputs, rank_outputs, sizeof(registration->rank_outputs));
+    for (int stop = 0; stop < TOCCATA_NUM_STOPS; ++stop) {
+        const int rank = stop % TOCCATA_NUM_RANKS;
+        if (stop_gains[stop] > 0.0f && synth->pipes[rank][0].multiplier > 0)
+            drawn[rank_outputs[rank]][toccata_ranks[rank].layout]++;
+    }
+    for (int output = 0; output < TOCCATA_NUM_OUTPUTS; ++output) {
+        for (int layout = 0; layout < TOCCATA_NUM_LAYOUTS; ++layout) {
+            if (drawn[output][layout] > drawn[registration->output][registration->layout]) {
+                registration->output = output;
+                registration->layout = layout;
+            }
+        }
+    }
+    for (int stop = 0; stop < TOCCATA_NUM_STOPS; ++stop) {
+        const int rank = stop % TOCCATA_NUM_RANKS;
+        registration->merged[stop] = stop_gains[stop] > 0.0f && synth->pipes[rank][0].multiplier > 0
+            && rank_outputs[rank] == registration->output && toccata_ranks[rank].layout == registration->layout;
+    }
+
+    // Each division merges its own stops
+    bool built = true;
+    for (int n = 0; n < TOCCATA_NUM_DIVISIONS * TOCCATA_NUM_KEYS && built; ++n) {
+        const int division = n / TOCCATA_NUM_KEYS;
+        const int k = n % TOCCATA_NUM_KEYS;
+
+        // Place the partials of each pipe at their harmonic of the key
+        // frequency, weighted as they sound once the attack is over
+        int harmonics = 0;
+        memset(real, 0, (MAX_MERGED_HARMONICS + 1) * sizeof(double));
+        memset(imag, 0, (MAX_MERGED_HARMONICS + 1) * sizeof(double));
+        for (int rank = 0; rank < TOCCATA_NUM_RANKS; ++rank) {
+            const int stop = TOCCATA_STOP(division, rank);
+            if (!registration->merged[stop])
+                continue;
+
+            const toccata_pipe_t* pipe = &synth->pipes[rank][k];
+            for (int zone = 0; zone < pipe->num_zones; ++zone) {
+                const toccata_zone_t* pipe_zone = &pipe->zones[zone];
+                const toccata_wavetable_t* table = pipe_zone->table;
+                const double weight = stop_gains[stop] * pipe_zone->gain * pipe_zone->sustain;
+                for (int h = 1; h <= table->harmonics && h * pipe->multiplier <= MAX_MERGED_HARMONICS; ++h) {
+                    const int harmonic = h * pipe->multiplier;
+                    real[harmonic] += weight * table->partials[2 * h];
+                    imag[harmonic] += weight * table->partials[2 * h + 1];
+                    harmonics = harmonic > harmonics ? harmonic : harmonics;
+                }
+            }
+        }
+
+        if (harmonics == 0)
+            continue;
+
+        int size_bits = ceil_log2(harmonics * MERGED_POINTS_PER_HARMONIC);
+        size_bits = size_bits < MIN_MERGED_TABLE_BITS ? MIN_MERGED_TABLE_BITS : size_bits;
+        toccata_wavetable_t* table = &registration->tables[division][k];
+        built = toccata_wavetable_build(table, real, imag, harmonics, size_bits);
+        if (built && lock)
+            toccata_wavetable_lock(table);
+    }
+
+    free(real);
+    free(imag);
+    if (!built) {
+        toccata_synth_free_registration(registration);
+        return NULL;
+    }
+    return registration;
+}
+
+void
+toccata_synth_free_registration(toccata_registration_t* registration)
+{
+    if (!registration)
+        return;
+
+    for (int division = 0; division < TOCCATA_NUM_DIVISIONS; ++division) {
+        for (int k = 0; k < TOCCATA_NUM_KEYS; ++k)
+            toccata_wavetable_free(&registration->tables[division][k]);
+    }
+    free(registration);
+}
+
+toccata_registration_t*
+toccata_synth_swap_registration(toccata_synth_t* synth, toccata_registration_t* registration)
+{
+    // Nothing may play from the previous tables once they are returned
+    expand_merged_voices(synth, true);
+
+    toccata_registration_t* previous = synth->registration;
+    synth->registration = registration;
+    for (int division = 0; division < TOCCATA_NUM_DIVISIONS; ++division) {
+        for (int k = 0; k < TOCCATA_NUM_KEYS; ++k) {
+            const int key = TOCCATA_LOWEST_KEY + k;
+            synth->merge_pending[division][k] = synth->keys_down[division][key] || synth->keys_sustained[division][key];
+        }
+    }
+    return previous;
+}
+
+bool
+toccata_synth_registration_changed(const toccata_synth_t* synth)
+{
+    const toccata_registration_t* registration = synth->registration;
+    for (int stop = 0; stop < TOCCATA_NUM_STOPS; ++stop) {
+        const float merged_gain = registration ? registration->stop_gains[stop] : 0.0f;
+        if (synth->stop_gains[stop] != merged_gain)
+            return true;
+    }
+    for (int rank = 0; rank < TOCCATA_NUM_RANKS; ++rank) {
+        if (registration && synth->rank_outputs[rank] != registration->rank_outputs[rank])
+            return true;
+    }
+    return false;
+}
+
+void
+toccata_synth_set_rank_output(toccata_synth_t* synth, int rank, int output)
+{
+    if (rank < 0 || rank >= TOCCATA_NUM_RANKS || output < 0 || output >= TOCCATA_NUM_OUTPUTS)
+        return;
+    if (synth->rank_outputs[rank] == output)
+        return;
+
+    // Merged voices only play on one output, so they go back to pipe
+    // voices until the tables are merged again
+    const toccata_registration_t* registration = synth->registration;
+    for (int division = 0; division < TOCCATA_NUM_DIVISIONS; ++division) {
+        if (registration && registration->merged[TOCCATA_STOP(division, rank)]) {
+            expand_merged_voices(synth, true);
+            break;
+        }
+    }
+    synth->rank_outputs[rank] = output;
+
+    bool used[TOCCATA_NUM_OUTPUTS] = { true };
+    for (int r = 0; r < TOCCATA_NUM_RANKS; ++r)
+        used[synth->rank_outputs[r]] = true;
+
+    // The decimator and delay of an output start again from silence
+    for (int o = 0; o < TOCCATA_NUM_OUTPUTS; ++o) {
+        for (int c = NUM_CHANNELS * o; c < NUM_CHANNELS * (o + 1); ++c) {
+            if (!used[o] || synth->outputs_used[o])
+                continue;
+            if (synth->oversampled)
+                memset(synth->oversampled + c * OVERSAMPLED_FRAMES(synth->samples_per_block), 0, TOCCATA_DECIMATOR_HISTORY * sizeof(float));
+            memset(synth->delay_lines[c], 0, sizeof(synth->delay_lines[c]));
+        }
+        synth->outputs_used[o] = used[o];
+    }
+}
+
+int
+toccata_synth_get_rank_output(const toccata_synth_t* synth, int rank)
+{
+    return synth->rank_outputs[rank];
+}
+
+void
+toccata_synth_set_thread_pool(toccata_synth_t* synth, toccata_pool_t* pool, int num_threads)
+{
+    const int max_threads = pool ? toccata_pool_get_num_threads(pool) + 1 : 1;
+    num_threads = num_threads < max_threads ? num_threads : max_threads;
+    num_threads = num_threads < TOCCATA_MAX_RENDER_THREADS ? num_threads : TOCCATA_MAX_RENDER_THREADS;
+    synth->num_render_threads = num_threads > 1 ? num_threads : 1;
+    synth->pool = synth->num_render_threads > 1 ? pool : NULL;
+}
+
+void
+toccata_synth_set_fixed_block_size(toccata_synth_t* synth, int block_size)
+{
+    synth->fixed_mix = toccata_get_mix(block_size);
+    synth->fixed_mix_ramp = toccata_get_mix_ramp(block_size);
+    synth->fixed_block_size = synth->fixed_mix != toccata_mix ? block_size : 0;
+}
+
+void
+toccata_synth_set_oversampling(toccata_synth_t* synth, int factor)
+{
+    synth->target_oversampling = factor > 1 ? TOCCATA_MAX_OVERSAMPLING : 1;
+}
+
+int
+toccata_synth_get_latency(const toccata_synth_t* synth)
+{
+    (void)synth;
+    return TOCCATA_DECIMATOR_DELAY;
+}
+
+void
+toccata_synth_set_rank_quality(toccata_synth_t* synth, int rank, int quality)
+{
+    quality = quality < TOCCATA_QUALITY_NEAREST ? TOCCATA_QUALITY_NEAREST : quality;
+    quality = quality > TOCCATA_QUALITY_CUBIC ? TOCCATA_QUALITY_CUBIC : quality;
+    synth->rank_qualities[rank] = quality;
+}
+
+void
+toccata_synth_set_gain_smoothing(toccata_synth_t* synth, float seconds)
+{
+    synth->gain_smoothing = seconds > 0.0f ? seconds : 0.0f;
+}
+
+void
+toccata_synth_set_tremulant(toccata_synth_t* synth, float rate, float depth)
+{
+    synth->tremulant_rate = rate > 0.0f ? rate : 0.0f;
+    depth = depth < 0.0f ? 0.0f : depth;
+    synth->tremulant_depth = depth > 1.0f ? 1.0f : depth;
+}
+
+void
+toccata_synth_set_wind_model(toccata_synth_t* synth, bool enabled)
+{
+    synth->wind_model = enabled;
+}
+
+float
+toccata_synth_get_stop_gain(const toccata_synth_t* synth, int stop)
+{
+    return synth->stop_gains[stop];
+}
+
+static void
+handle_note_on(toccata_synth_t* synth, int division, int key)
+{
+    synth->keys_down[division][key] = true;
+    synth->keys_sustained[division][key] = false;
+    if (key < TOCCATA_LOWEST_KEY || key > TOCCATA_HIGHEST_KEY)
+        return;
+
+    toccata_voice_t* merged = merged_voice(synth, division, key);
+    if (merged->active)
+        retire_voice(synth, merged);
+
+    // Stops that are pushed in stay silent, so they get no voices;
+    // set_stop_gain() starts them if the stop is drawn while the key is held.
+    for (int rank = 0; rank < TOCCATA_NUM_RANKS; ++rank) {
+        const int stop = TOCCATA_STOP(division, rank);
+        if (synth->stop_gains[stop] > 0.0f)
+            start_pipe(synth, stop, key);
+    }
+}
+
+static void
+handle_note_off(toccata_synth_t* synth, int division, int key)
+{
+    const bool sustain_pedal = synth->sustain_pedal[division];
+    synth->keys_down[division][key] = false;
+    synth->keys_sustained[division][key] = sustain_pedal;
+    if (key < TOCCATA_LOWEST_KEY || key > TOCCATA_HIGHEST_KEY)
+        return;
+
+    // Overflow voices are already releasing, so only the pipes, their
+    // attack transients and the merged voice matter
+    for (int i = 0; i <= TOCCATA_NUM_RANKS * VOICES_PER_PIPE; ++i) {
+        toccata_voice_t* voice = i < TOCCATA_NUM_RANKS * VOICES_PER_PIPE
+            ? pipe_voice(synth, TOCCATA_STOP(division, i / VOICES_PER_PIPE), key, i % VOICES_PER_PIPE)
+            : merged_voice(synth, division, key);
+        if (!voice->active || voice->stage == STAGE_RELEASE)
+            continue;
+
+        if (sustain_pedal)
+            voice->sustained = true;
+        else
+            release_voice(voice);
+    }
+
+    if (!sustain_pedal)
+        synth->merge_pending[division][key - TOCCATA_LOWEST_KEY] = false;
+}
+
+static void
+silence_stop(toccata_synth_t* synth, int stop)
+{
+    for (int i = 0; i < synth->num_active_voices; ++i) {
+        toccata_voice_t* voice = &synth->voices[synth->active_voices[i]];
+        if (voice->active && voice->stop == stop)
+            voice->active = false;
+    }
+}
+
+static void
+set_stop_gain(toccata_synth_t* synth, int stop, float gain)
+{
+    const int division = stop / TOCCATA_NUM_RANKS;
+    const bool was_drawn = synth->stop_gains[stop] > 0.0f;
+    const bool drawn = gain > 0.0f;
+
+    // The merged voices of held keys go back to pipe voices, which follow
+    // the stop gains, until the tables are merged again for the new gains
+    const toccata_registration_t* registration = synth->registration;
+    if (registration && registration->merged[stop] && registration->stop_gains[stop] != gain)
+        expand_merged_voices(synth, false);
+
+    synth->stop_gains[stop] = gain;
+    const int ramp_frames = (int)(synth->gain_smoothing * synth->render_rate);
+    if (ramp_frames > 0) {
+        synth->gain_steps[stop] = (gain - synth->bus_gains[stop]) / (float)ramp_frames;
+        synth->gain_frames[stop] = ramp_frames;
+    } else {
+        synth->bus_gains[stop] = gain;
+        synth->gain_frames[stop] = 0;
+    }
+
+    if (drawn == was_drawn)
+        return;
+
+    if (drawn) {
+        // Drawing a stop makes its pipes speak for the keys being held on
+        // its division, unless they are still fading out
+        for (int key = TOCCATA_LOWEST_KEY; key <= TOCCATA_HIGHEST_KEY; ++key) {
+            const bool held = synth->keys_down[division][key] || synth->keys_sustained[division][key];
+            if (held && !pipe_voice(synth, stop, key, 0)->active)
+                start_pipe(synth, stop, key);
+        }
+    } else if (ramp_frames == 0) {
+        // The stop is silent now, so its voices can stop right away;
+        // otherwise they stop at the end of the ramp
+        silence_stop(synth, stop);
+    }
+}
+
+/**
+   Stops sound at the gain they are drawn at, or at the one of the
+   crescendo step if it is higher.
+*/
+static float
+sounding_gain(const toccata_synth_t* synth, int stop)
+{
+    const float crescendo = toccata_crescendo[synth->crescendo_step][stop % TOCCATA_NUM_RANKS];
+    return synth->drawn_gains[stop] > crescendo ? synth->drawn_gains[stop] : crescendo;
+}
+
+static void
+draw_stop(toccata_synth_t* synth, int stop, float gain)
+{
+    synth->drawn_gains[stop] = gain;
+    set_stop_gain(synth, stop, sounding_gain(synth, stop));
+}
+
+/**
+   Move the crescendo pedal. Only a change of step touches the stops, in
+   one pass, so that a sweep of the pedal is as cheap as a few stop
+   changes; they ramp like any other.
+*/
+static void
+set_crescendo(toccata_synth_t* synth, float value)
+{
+    value = value < 0.0f ? 0.0f : value > 1.0f ? 1.0f : value;
+    const int step = (int)(value * (float)(TOCCATA_CRESCENDO_STEPS - 1) + 0.5f);
+    if (step == synth->crescendo_step)
+        return;
+
+    synth->crescendo_step = step;
+    for (int stop = 0; stop < TOCCATA_NUM_STOPS; ++stop) {
+        const float gain = sounding_gain(synth, stop);
+        if (gain != synth->stop_gains[stop])
+            set_stop_gain(synth, stop, gain);
+    }
+}
+
+static void
+handle_cc(toccata_synth_t* synth, int division, int cc, float value)
+{
+    switch (cc) {
+    case CRESCENDO_CC:
+        set_crescendo(synth, value);
+        break;
+    case EXPRESSION_CC:
+        if (division == TOCCATA_ENCLOSED_DIVISION)
+            synth->swell_target = value < 0.0f ? 0.0f : value > 1.0f ? 1.0f : value;
+        break;
+    case SUSTAIN_CC:
+        synth->sustain_pedal[division] = value >= 0.5f;
+        if (synth->sustain_pedal[division])
+            break;
+        memset(synth->keys_sustained[division], 0, sizeof(synth->keys_sustained[division]));
+        for (int k = 0; k < TOCCATA_NUM_KEYS; ++k)
+            synth->merge_pending[division][k] &= synth->keys_down[division][TOCCATA_LOWEST_KEY + k];
+        for (int i = 0; i < synth->num_active_voices; ++i) {
+            toccata_voice_t* voice = &synth->voices[synth->active_voices[i]];
+            if (voice->active && voice->sustained && voice->division == division)
+                release_voice(voice);
+        }
+        break;
+    case ALL_SOUND_OFF_CC:
+        toccata_synth_all_sound_off(synth);
+        break;
+    case ALL_NOTES_OFF_CC:
+        for (int key = 0; key < 128; ++key) {
+            if (synth->keys_down[division][key])
+                handle_note_off(synth, division, key);
+        }
+        break;
+    default:
+        for (int rank = 0; rank < TOCCATA_NUM_RANKS; ++rank) {
+            if (toccata_ranks[rank].cc == cc)
+                draw_stop(synth, TOCCATA_STOP(division, rank), value);
+        }
+        break;
+    }
+}
+
+static void
+handle_event(toccata_synth_t* synth, const toccata_event_t* event)
+{
+    if (event->division < 0 || event->division >= TOCCATA_NUM_DIVISIONS)
+        return;
+
+    switch (event->type) {
+    case EVENT_NOTE_ON:
+        handle_note_on(synth, event->division, event->number & 0x7F);
+        break;
+    case EVENT_NOTE_OFF:
+        handle_note_off(synth, event->division, event->number & 0x7F);
+        break;
+    case EVENT_CC:
+        handle_cc(synth, event->division, event->number, event->value);
+        break;
+    case EVENT_STOP_GAIN:
+        if (event->number >= 0 && event->number < TOCCATA_NUM_STOPS)
+            draw_stop(synth, event->number, event->value);
+        break;
+    }
+}
+
+static FORCE_INLINE void
+render_envelope(toccata_voice_t* voice, float* envelope, int num_frames)
+{
+    int i = 0;
+    while (i < num_frames) {
+        switch (voice->stage) {
+        case STAGE_ATTACK:
+            for (; i < num_frames && voice->level < voice->peak; ++i) {
+                envelope[i] = voice->level;
+                voice->level += voice->attack_step;
+            }
+            if (voice->level >= voice->peak) {
+                voice->level = voice->peak;
+                voice->stage = voice->peak > voice->sustain ? STAGE_DECAY : STAGE_SUSTAIN;
+            }
+            break;
+        case STAGE_DECAY:
+            for (; i < num_frames && voice->level - voice->sustain > ENVELOPE_FLOOR; ++i) {
+                envelope[i] = voice->level;
+                voice->level = voice->sustain + (voice->level - voice->sustain) * voice->decay_rate;
+            }
+            if (voice->level - voice->sustain <= ENVELOPE_FLOOR) {
+                voice->level = voice->sustain;
+                voice->stage = STAGE_SUSTAIN;
+            }
+            break;
+        case STAGE_SUSTAIN:
+            for (; i < num_frames; ++i)
+                envelope[i] = voice->level;
+            break;
+        case STAGE_RELEASE:
+            for (; i < num_frames && voice->level > ENVELOPE_FLOOR; ++i) {
+                envelope[i] = voice->level;
+                voice->level *= voice->release_rate;
+            }
+            if (voice->level <= ENVELOPE_FLOOR) {
+                voice->active = false;
+                for (; i < num_frames; ++i)
+                    envelope[i] = 0.0f;
+            }
+            break;
+        }
+    }
+}
+
+static FORCE_INLINE void
+render_fade(toccata_voice_t* voice, float* envelope, int num_frames)
+{
+    float fade = voice->fade;
+    const float step = voice->fade_step;
+    for (int i = 0; i < num_frames; ++i) {
+        envelope[i] *= fade;
+        fade = fminf(1.0f, fmaxf(0.0f, fade + step));
+    }
+    voice->fade = fade;
+
+    // The transient is over, and its slot free for the next note
+    if (step < 0.0f && fade == 0.0f)
+        voice->active = false;
+    if (step > 0.0f && fade == 1.0f)
+        voice->fade_step = 0.0f;
+}
+
+static FORCE_INLINE void
+render_voice(toccata_voice_t* voice, int quality, uint32_t increment, float level, float* envelope, float* left,
+    float* right, int num_frames)
+{
+    render_envelope(voice, envelope, num_frames);
+    if (voice->fade_step != 0.0f)
+        render_fade(voice, envelope, num_frames);
+
+    // The phase is a 32-bit fraction of the period; its top bits index the table
+    const float* table = voice->mip->data;
+    const int shift = 32 - voice->mip->size_bits;
+    const uint32_t fraction_mask = (1u << shift) - 1;
+    const float fraction_scale = 1.0f / (float)(1u << shift);
+    const float left_gain = level * voice->gains[0];
+    const float right_gain = level * voice->gains[1];
+    uint32_t phase = voice->phase;
+
+    switch (quality) {
+    case TOCCATA_QUALITY_NEAREST: {
+        const uint32_t half = 1u << (shift - 1);
+        for (int i = 0; i < num_frames; ++i) {
+            // Rounding past the last point reads the wrap-around guard point
+            const uint32_t index = (uint32_t)(((uint64_t)phase + half) >> shift);
+            const float sample = envelope[i] * table[index];
+            left[i] += left_gain * sample;
+            right[i] += right_gain * sample;
+            phase += increment;
+        }
+        break;
+    }
+    case TOCCATA_QUALITY_LINEAR:
+        for (int i = 0; i < num_frames; ++i) {
+            const uint32_t index = phase >> shift;
+            const float fraction = (float)(phase & fraction_mask) * fraction_scale;
+            const float sample = envelope[i] * (table[index] + fraction * (table[index + 1] - table[index]));
+            left[i] += left_gain * sample;
+            right[i] += right_gain * sample;
+            phase += increment;
+        }
+        break;
+    default:
+        // 4-point, 3rd-order Hermite
+        for (int i = 0; i < num_frames; ++i) {
+            const uint32_t index = phase >> shift;
+            const float fraction = (float)(phase & fraction_mask) * fraction_scale;
+            // The table has guard points on both sides of the period
+            const float* points = table + index;
+            const float xm1 = points[-1];
+            const float x0 = points[0];
+            const float x1 = points[1];
+            const float x2 = points[2];
+            const float c1 = 0.5f * (x1 - xm1);
+            const float c2 = xm1 - 2.5f * x0 + 2.0f * x1 - 0.5f * x2;
+            const float c3 = 0.5f * (x2 - xm1) + 1.5f * (x0 - x1);
+            const float sample = envelope[i] * (((c3 * fraction + c2) * fraction + c1) * fraction + x0);
+            left[i] += left_gain * sample;
+            right[i] += right_gain * sample;
+            phase += increment;
+        }
+        break;
+    }
+    voice->phase = phase;
+}
+
+/**
+   The voices of a segment, split between render tasks: each stop bus is
+   rendered by one task, and each task renders a share of the merged
+   voices into its own merged bus.
+*/
+typedef struct {
+    toccata_synth_t* synth;
+    int num_frames;
+    double pitches[TOCCATA_NUM_DIVISIONS]; ///< Ratios of the phase increments, from the tremulant and the wind
+    float levels[TOCCATA_NUM_DIVISIONS]; ///< Gains from the wind pressure
+    bool swell; ///< The enclosed division plays through the swell box
+    uint32_t key_increments[TOCCATA_NUM_DIVISIONS][TOCCATA_NUM_KEYS]; ///< With the pitch of each division
+    int qualities[NUM_BUSES];
+    int tasks[TOCCATA_NUM_STOPS]; ///< Task that renders each stop bus
+    int merged_ends[TOCCATA_MAX_RENDER_THREADS]; ///< End of the share of merged voices of each task
+    bool bus_active[NUM_ALLOCATED_BUSES];
+} toccata_render_job_t;
+
+/**
+   The phase increment of a voice with the pitch of its division. Pipes
+   locked to the key phase scale the increment of their key, so that they
+   stay in phase with the merged voices.
+*/
+static FORCE_INLINE uint32_t
+voice_increment(const toccata_render_job_t* job, const toccata_voice_t* voice)
+{
+    const double pitch = job->pitches[voice->division];
+    if (pitch == 1.0)
+        return voice->phase_increment;
+    if (voice->multiplier > 0)
+        return (uint32_t)voice->multiplier * job->key_increments[voice->division][voice->key - TOCCATA_LOWEST_KEY];
+    return (uint32_t)((double)voice->phase_increment * pitch);
+}
+
+static int
+merged_bus(int task)
+{
+    return task == 0 ? MERGED_BUS : NUM_BUSES + task - 1;
+}
+
+static FORCE_INLINE void
+render_voices(toccata_render_job_t* job, int task, int num_frames)
+{
+    toccata_synth_t* synth = job->synth;
+    float* envelope = synth->envelope + task * synth->samples_per_block;
+    const int merged_begin = task > 0 ? job->merged_ends[task - 1] : 0;
+    const int merged_end = job->merged_ends[task];
+    int merged_index = 0;
+
+    // Only the voices of this task are read, since the others may change
+    // on their own thread
+    for (int i = 0; i < synth->num_active_voices; ++i) {
+        toccata_voice_t* voice = &synth->voices[synth->active_voices[i]];
+        int bus_index;
+        if (voice->stop == MERGED_BUS) {
+            const int index = merged_index++;
+            if (index < merged_begin || index >= merged_end)
+                continue;
+            const bool enclosed = job->swell && voice->division == TOCCATA_ENCLOSED_DIVISION;
+            bus_index = enclosed ? ENCLOSED_MERGED_BUS + task : merged_bus(task);
+        } else {
+            if (job->tasks[voice->stop] != task)
+                continue;
+            bus_index = voice->stop;
+        }
+        if (!voice->active)
+            continue;
+
+        float* left = synth->stop_buses + bus_index * NUM_CHANNELS * synth->samples_per_block;
+        float* right = left + synth->samples_per_block;
+        if (!job->bus_active[bus_index]) {
+            memset(left, 0, num_frames * sizeof(float));
+            memset(right, 0, num_frames * sizeof(float));
+            job->bus_active[bus_index] = true;
+        }
+        render_voice(voice, job->qualities[voice->stop], voice_increment(job, voice), job->levels[voice->division],
+            envelope, left, right, num_frames);
+    }
+}
+
+// Voice rendering with a constant frame count, for the block sizes that
+// have specialized kernels
+#define FIXED_BLOCK_RENDER(N)                                                                    \
+    static void                                                                                  \
+    render_voices_##N(toccata_render_job_t* job, int task)                                       \
+    {                                                                                            \
+        render_voices(job, task, N);                                                             \
+    }
+
+FIXED_BLOCK_RENDER(64)
+FIXED_BLOCK_RENDER(128)
+FIXED_BLOCK_RENDER(256)
+
+static void
+render_task(void* data, int task)
+{
+    toccata_render_job_t* job = (toccata_render_job_t*)data;
+    switch (job->num_frames == job->synth->fixed_block_size ? job->num_frames : 0) {
+    case 64:
+        render_voices_64(job, task);
+        break;
+    case 128:
+        render_voices_128(job, task);
+        break;
+    case 256:
+        render_voices_256(job, task);
+        break;
+    default:
+        render_voices(job, task, job->num_frames);
+        break;
+    }
+}
+
+/**
+   Spread the stop buses over the render tasks, the busiest first, each to
+   the least loaded task, then even out the loads with the merged voices.
+   The voice counts are those of the previous segment. Returns the number
+   of tasks that have voices.
+*/
+static int
+split_job(const toccata_synth_t* synth, toccata_render_job_t* job)
+{
+    const int num_threads = synth->num_render_threads;
+    int loads[TOCCATA_MAX_RENDER_THREADS] = { 0 };
+    bool assigned[TOCCATA_NUM_STOPS] = { false };
+    for (int n = 0; n < TOCCATA_NUM_STOPS; ++n) {
+        int stop = -1;
+        for (int s = 0; s < TOCCATA_NUM_STOPS; ++s) {
+            if (!assigned[s] && (stop < 0 || synth->bus_voices[s] > synth->bus_voices[stop]))
+                stop = s;
+        }
+        int task = 0;
+        for (int t = 1; t < num_threads; ++t) {
+            if (loads[t] < loads[task])
+                task = t;
+        }
+        job->tasks[stop] = task;
+        loads[task] += synth->bus_voices[stop];
+        assigned[stop] = true;
+    }
+
+    int total = synth->bus_voices[MERGED_BUS];
+    for (int t = 0; t < num_threads; ++t)
+        total += loads[t];
+    const int target = (total + num_threads - 1) / num_threads;
+
+    int merged_end = 0;
+    for (int t = 0; t < num_threads; ++t) {
+        const int share = loads[t] < target ? target - loads[t] : 0;
+        merged_end += share;
+        loads[t] += share;
+        job->merged_ends[t] = merged_end;
+    }
+
+    int num_tasks = 0;
+    while (num_tasks < num_threads && loads[num_tasks] > 0)
+        ++num_tasks;
+
+    // Voices started since the count go to the last task
+    const int last_task = num_tasks > 0 ? num_tasks - 1 : 0;
+    for (int stop = 0; stop < TOCCATA_NUM_STOPS; ++stop) {
+        if (job->tasks[stop] > last_task)
+            job->tasks[stop] = last_task;
+    }
+    job->merged_ends[last_task] = synth->num_voices;
+    return num_tasks;
+}
+
+/**
+   Advance the tremulant over a segment, and get the amplitude it reaches
+   at the end. The amplitude ramps from the end of the previous segment, so
+   depth changes are smooth too.
+*/
+static float
+advance_tremulant(toccata_synth_t* synth, int num_frames)
+{
+    if (synth->tremulant_depth == 0.0f)
+        return 1.0f;
+
+    synth->tremulant_phase += (double)synth->tremulant_rate * num_frames / synth->render_rate;
+    synth->tremulant_phase -= floor(synth->tremulant_phase);
+    const float swing = synth->tremulant_depth * TREMULANT_AMPLITUDE;
+    return 1.0f + swing * sinf(2.0f * (float)M_PI * (float)synth->tremulant_phase);
+}
+
+/**
+   Move the wind pressure of each division toward the one its held pipes
+   leave, from the voices of the segment.
+*/
+static void
+update_wind(toccata_synth_t* synth, int num_frames)
+{
+    float loads[TOCCATA_NUM_DIVISIONS] = { 0.0f };
+    bool steady = true;
+    for (int division = 0; division < TOCCATA_NUM_DIVISIONS; ++division)
+        steady = steady && synth->wind_pressures[division] == 1.0f;
+    if (!synth->wind_model && steady)
+        return;
+
+    if (synth->wind_model) {
+        for (int i = 0; i < synth->num_active_voices; ++i) {
+            const toccata_voice_t* voice = &synth->voices[synth->active_voices[i]];
+            if (voice->active && voice->stage != STAGE_RELEASE)
+                loads[voice->division] += voice->wind;
+        }
+    }
+
+    const float response = 1.0f - expf(-(float)num_frames / (WIND_RESPONSE_TIME * synth->render_rate));
+    for (int division = 0; division < TOCCATA_NUM_DIVISIONS; ++division) {
+        const float load = loads[division];
+        const float target = 1.0f - WIND_SAG * load / (load + WIND_SUPPLY);
+        float pressure = synth->wind_pressures[division];
+        pressure += (target - pressure) * response;
+        // Settle exactly, so that an idle wind model costs nothing
+        if (target == 1.0f && pressure > 1.0f - 1e-6f)
+            pressure = 1.0f;
+        synth->wind_pressures[division] = pressure;
+    }
+}
+
+/**
+   Move the shutters of the swell box toward the expression, and get the
+   pole of its lowpass and the gain it reaches at the end of the segment.
+   The open box passes its input unchanged.
+*/
+static float
+update_swell(toccata_synth_t* synth, int num_frames, float* pole)
+{
+    const float response = 1.0f - expf(-(float)num_frames / (SWELL_RESPONSE_TIME * synth->render_rate));
+    synth->swell += (synth->swell_target - synth->swell) * response;
+    if (fabsf(synth->swell_target - synth->swell) < 1e-4f)
+        synth->swell = synth->swell_target;
+
+    // The cutoff rises exponentially as the box opens, and the pole is
+    // offset to reach 0 when it is fully open
+    const float cutoff = SWELL_CLOSED_CUTOFF * powf(SWELL_OPEN_CUTOFF / SWELL_CLOSED_CUTOFF, synth->swell);
+    const float open = expf(-2.0f * (float)M_PI * SWELL_OPEN_CUTOFF / synth->render_rate);
+    const float closed = expf(-2.0f * (float)M_PI * cutoff / synth->render_rate);
+    *pole = closed > open ? (closed - open) / (1.0f - open) : 0.0f;
+    return powf(SWELL_CLOSED_GAIN, 1.0f - synth->swell);
+}
+
+/**
+   The swell bus of an output, cleared on first use in a segment.
+*/
+static float*
+swell_bus(toccata_synth_t* synth, toccata_render_job_t* job, int output, int num_frames)
+{
+    const int bus = SWELL_BUS + output;
+    float* left = synth->stop_buses + bus * NUM_CHANNELS * synth->samples_per_block;
+    if (!job->bus_active[bus]) {
+        for (int c = 0; c < NUM_CHANNELS; ++c)
+            memset(left + c * synth->samples_per_block, 0, num_frames * sizeof(float));
+        job->bus_active[bus] = true;
+    }
+    return left;
+}
+
+static void
+render_segment(toccata_synth_t* synth, float** outputs, int num_frames)
+{
+    toccata_render_job_t job = { .synth = synth, .num_frames = num_frames };
+    const bool* bus_active = job.bus_active;
+    float* buses = synth->stop_buses;
+
+    // Merged voices stand for their stops, so they use the lowest quality
+    // among them
+    int* qualities = job.qualities;
+    qualities[MERGED_BUS] = TOCCATA_QUALITY_CUBIC;
+    for (int stop = 0; stop < TOCCATA_NUM_STOPS; ++stop) {
+        qualities[stop] = synth->rank_qualities[stop % TOCCATA_NUM_RANKS];
+        if (synth->registration && synth->registration->merged[stop] && qualities[stop] < qualities[MERGED_BUS])
+            qualities[MERGED_BUS] = qualities[stop];
+    }
+
+    if (synth->registration) {
+        for (int division = 0; division < TOCCATA_NUM_DIVISIONS; ++division) {
+            for (int k = 0; k < TOCCATA_NUM_KEYS; ++k) {
+                if (synth->merge_pending[division][k] && merge_pipes(synth, division, TOCCATA_LOWEST_KEY + k))
+                    synth->merge_pending[division][k] = false;
+            }
+        }
+    }
+
+    // The pitch follows the wind pressure over the segment
+    const float tremulant_begin = synth->tremulant_level;
+    const float tremulant_end = advance_tremulant(synth, num_frames);
+    const float tremulant_middle = 0.5f * (tremulant_begin + tremulant_end);
+    double pitch = 1.0;
+    if (tremulant_middle != 1.0f)
+        pitch = 1.0 + (double)((tremulant_middle - 1.0f) * (TREMULANT_PITCH / TREMULANT_AMPLITUDE));
+
+    update_wind(synth, num_frames);
+    for (int division = 0; division < TOCCATA_NUM_DIVISIONS; ++division) {
+        const float pressure = synth->wind_pressures[division];
+        job.levels[division] = pressure;
+        job.pitches[division] = pitch;
+        if (pressure != 1.0f)
+            job.pitches[division] *= 1.0 - (double)((1.0f - pressure) * WIND_PITCH);
+
+        for (int k = 0; k < TOCCATA_NUM_KEYS; ++k) {
+            const uint32_t increment = synth->key_increments[k];
+            job.key_increments[division][k] = job.pitches[division] == 1.0 ? increment
+                : (uint32_t)((double)increment * job.pitches[division]);
+        }
+    }
+
+    float swell_pole;
+    const float swell_begin = synth->swell_gain;
+    const float swell_end = update_swell(synth, num_frames, &swell_pole);
+    job.swell = swell_begin != 1.0f || swell_end != 1.0f;
+
+    // Each task renders its voices with its own envelope buffer, and the
+    // buses are summed below once all tasks are done
+    const int num_tasks = synth->pool ? split_job(synth, &job) : 1;
+    if (num_tasks > 1) {
+        toccata_pool_run(synth->pool, render_task, &job, num_tasks);
+    } else {
+        job.merged_ends[0] = synth->num_voices;
+        render_task(&job, 0);
+    }
+
+    // Drop the voices that stopped from the list, and count the others for
+    // the next split
+    int num_active_voices = 0;
+    memset(synth->bus_voices, 0, sizeof(synth->bus_voices));
+    for (int i = 0; i < synth->num_active_voices; ++i) {
+        const int index = synth->active_voices[i];
+        if (synth->voices[index].active) {
+            synth->active_voices[num_active_voices++] = index;
+            synth->bus_voices[synth->voices[index].stop]++;
+        } else {
+            synth->voices[index].listed = false;
+        }
+    }
+    synth->num_active_voices = num_active_voices;
+
+    for (int division = 0; division < TOCCATA_NUM_DIVISIONS; ++division) {
+        for (int k = 0; k < TOCCATA_NUM_KEYS; ++k)
+            synth->key_phases[division][k] += job.key_increments[division][k] * (uint32_t)num_frames;
+    }
+
+    const bool fixed = num_frames == synth->fixed_block_size;
+    const toccata_mix_function_t mix = fixed ? synth->fixed_mix : toccata_mix;
+    const toccata_mix_ramp_function_t mix_ramp = fixed ? synth->fixed_mix_ramp : toccata_mix_ramp;
+
+    // The stop gains are part of the merged tables
+    const int merged_output = synth->registration ? synth->registration->output : 0;
+    for (int task = 0; task < num_tasks; ++task) {
+        const int bus = merged_bus(task);
+        for (int c = 0; c < NUM_CHANNELS && bus_active[bus]; ++c) {
+            float* output = outputs[NUM_CHANNELS * merged_output + c];
+            if (output)
+                mix(output, buses + (NUM_CHANNELS * bus + c) * synth->samples_per_block, 1.0f, num_frames);
+        }
+
+        const int enclosed_bus = ENCLOSED_MERGED_BUS + task;
+        if (!bus_active[enclosed_bus])
+            continue;
+        float* swell = swell_bus(synth, &job, merged_output, num_frames);
+        for (int c = 0; c < NUM_CHANNELS; ++c) {
+            mix(swell + c * synth->samples_per_block,
+                buses + (NUM_CHANNELS * enclosed_bus + c) * synth->samples_per_block, 1.0f, num_frames);
+        }
+    }
+
+    for (int stop = 0; stop < TOCCATA_NUM_STOPS; ++stop) {
+        const int ramp_frames = synth->gain_frames[stop] < num_frames ? synth->gain_frames[stop] : num_frames;
+        const int rank_output = synth->rank_outputs[stop % TOCCATA_NUM_RANKS];
+        const bool enclosed = job.swell && stop / TOCCATA_NUM_RANKS == TOCCATA_ENCLOSED_DIVISION;
+        for (int c = 0; c < NUM_CHANNELS && bus_active[stop]; ++c) {
+            float* output = enclosed ? swell_bus(synth, &job, rank_output, num_frames) + c * synth->samples_per_block
+                                     : outputs[NUM_CHANNELS * rank_output + c];
+            const float* bus = buses + (NUM_CHANNELS * stop + c) * synth->samples_per_block;
+            if (ramp_frames == num_frames) {
+                mix_ramp(output, bus, synth->bus_gains[stop], synth->gain_steps[stop], num_frames);
+            } else if (ramp_frames > 0) {
+                toccata_mix_ramp(output, bus, synth->bus_gains[stop], synth->gain_steps[stop], ramp_frames);
+                toccata_mix(output + ramp_frames, bus + ramp_frames, synth->stop_gains[stop], num_frames - ramp_frames);
+            } else if (synth->bus_gains[stop] != 0.0f) {
+                mix(output, bus, synth->bus_gains[stop], num_frames);
+            }
+        }
+
+        if (ramp_frames > 0) {
+            const float step = synth->gain_steps[stop];
+
+            synth->gain_frames[stop] -= ramp_frames;
+            synth->bus_gains[stop] += step * (float)ramp_frames;
+            if (synth->gain_frames[stop] == 0) {
+                synth->bus_gains[stop] = synth->stop_gains[stop];
+                if (synth->stop_gains[stop] == 0.0f)
+                    silence_stop(synth, stop);
+            }
+        }
+    }
+
+    // The swell buses go through the box even when silent, so that the
+    // lowpass rings out
+    if (job.swell) {
+        const float step = (swell_end - swell_begin) / (float)num_frames;
+        for (int output = 0; output < TOCCATA_NUM_OUTPUTS; ++output) {
+            if (!synth->outputs_used[output])
+                continue;
+            float* swell = swell_bus(synth, &job, output, num_frames);
+            for (int c = 0; c < NUM_CHANNELS; ++c) {
+                float* bus = swell + c * synth->samples_per_block;
+                float* state = &synth->swell_states[output][c];
+                toccata_lowpass(bus, swell_pole, state, num_frames);
+                if (fabsf(*state) < SWELL_STATE_FLOOR)
+                    *state = 0.0f;
+                mix_ramp(outputs[NUM_CHANNELS * output + c], bus, swell_begin, step, num_frames);
+            }
+        }
+    } else {
+        memset(synth->swell_states, 0, sizeof(synth->swell_states));
+    }
+    synth->swell_gain = swell_end;
+
+    if (tremulant_begin != 1.0f || tremulant_end != 1.0f) {
+        const float step = (tremulant_end - tremulant_begin) / (float)num_frames;
+        for (int c = 0; c < NUM_OUTPUT_CHANNELS; ++c) {
+            if (outputs[c])
+                toccata_scale_ramp(outputs[c], tremulant_begin, step, num_frames);
+        }
+    }
+    synth->tremulant_level = tremulant_end;
+}
+
+/**
+   Move the running voices to a new render rate, keeping their pitch,
+   envelopes and gain ramps.
+*/
+static void
+set_render_oversampling(toccata_synth_t* synth, int oversampling)
+{
+    const float ratio = (float)synth->oversampling / (float)oversampling;
+    synth->oversampling = oversampling;
+    synth->render_rate = synth->sample_rate * (float)oversampling;
+    update_key_increments(synth);
+
+    for (int i = 0; i < synth->num_active_voices; ++i) {
+        toccata_voice_t* voice = &synth->voices[synth->active_voices[i]];
+        if (!voice->active)
+            continue;
+
+        const int k = voice->key - TOCCATA_LOWEST_KEY;
+        if (voice->stop == MERGED_BUS)
+            voice->phase_increment = synth->key_increments[k];
+        else
+            voice->phase_increment = pipe_increment(synth, stop_pipe(synth, voice->stop, voice->key), k);
+        voice->attack_step *= ratio;
+        voice->decay_rate = powf(voice->decay_rate, ratio);
+        voice->release_rate = powf(voice->release_rate, ratio);
+        voice->fade_step *= ratio;
+    }
+
+    for (int stop = 0; stop < TOCCATA_NUM_STOPS; ++stop) {
+        if (synth->gain_frames[stop] == 0)
+            continue;
+        const int frames = (int)ceilf((float)synth->gain_frames[stop] / ratio);
+        synth->gain_frames[stop] = frames;
+        synth->gain_steps[stop] = (synth->stop_gains[stop] - synth->bus_gains[stop]) / (float)frames;
+    }
+}
+
+static void
+render_oversampled(toccata_synth_t* synth, float** outputs, int num_frames)
+{
+    float* inputs[NUM_OUTPUT_CHANNELS];
+    const int num_input_frames = TOCCATA_MAX_OVERSAMPLING * num_frames;
+    for (int c = 0; c < NUM_OUTPUT_CHANNELS; ++c) {
+        inputs[c] = NULL;
+        if (outputs[c]) {
+            inputs[c] = synth->oversampled + c * OVERSAMPLED_FRAMES(synth->samples_per_block) + TOCCATA_DECIMATOR_HISTORY;
+            memset(inputs[c], 0, num_input_frames * sizeof(float));
+        }
+    }
+    render_segment(synth, inputs, num_input_frames);
+
+    // Every output channel follows the same crossfade
+    const float target = synth->target_oversampling > 1 ? 1.0f : 0.0f;
+    const float decimator_mix = synth->decimator_mix;
+    const int decimator_warmup = synth->decimator_warmup;
+    for (int c = 0; c < NUM_OUTPUT_CHANNELS; ++c) {
+        float* output = outputs[c];
+        const float* input = inputs[c];
+        if (!output)
+            continue;
+
+        toccata_decimate(output, input, num_frames);
+
+        // Plain decimation of the center tap has the delay of the filter, so
+        // that the crossfade does not comb
+        synth->decimator_mix = decimator_mix;
+        synth->decimator_warmup = decimator_warmup;
+        if (synth->decimator_mix != target || synth->decimator_warmup > 0) {
+            const float step = 1.0f / (OVERSAMPLING_FADE_TIME * synth->sample_rate);
+            for (int i = 0; i < num_frames; ++i) {
+                if (synth->decimator_warmup > 0)
+                    --synth->decimator_warmup;
+                else if (synth->decimator_mix < target)
+                    synth->decimator_mix = fminf(target, synth->decimator_mix + step);
+                else
+                    synth->decimator_mix = fmaxf(target, synth->decimator_mix - step);
+                const float plain = input[TOCCATA_MAX_OVERSAMPLING * (i - TOCCATA_DECIMATOR_DELAY)];
+                output[i] = plain + synth->decimator_mix * (output[i] - plain);
+            }
+        }
+
+        // Once faded out, the plain decimation goes on through the delay
+        // line at the sample rate
+        if (target == 0.0f && synth->decimator_mix == 0.0f) {
+            for (int i = 0; i < TOCCATA_DECIMATOR_DELAY; ++i)
+                synth->delay_lines[c][i] = input[TOCCATA_MAX_OVERSAMPLING * (num_frames - TOCCATA_DECIMATOR_DELAY + i)];
+        }
+
+        memmove(inputs[c] - TOCCATA_DECIMATOR_HISTORY, input + num_input_frames - TOCCATA_DECIMATOR_HISTORY,
+            TOCCATA_DECIMATOR_HISTORY * sizeof(float));
+    }
+
+    if (target == 0.0f && synth->decimator_mix == 0.0f)
+        set_render_oversampling(synth, 1);
+}
+
+/**
+   Delay the rendering at the sample rate as much as the decimator, so
+   that switching the oversampling neither drops nor repeats frames.
+*/
+static void
+delay_segment(toccata_synth_t* synth, float** outputs, int num_frames)
+{
+    const int delay = TOCCATA_DECIMATOR_DELAY;
+    for (int c = 0; c < NUM_OUTPUT_CHANNELS; ++c) {
+        float* output = outputs[c];
+        float* line = synth->delay_lines[c];
+        if (!output)
+            continue;
+
+        float tail[TOCCATA_DECIMATOR_DELAY];
+        if (num_frames >= delay) {
+            memcpy(tail, output + num_frames - delay, delay * sizeof(float));
+            memmove(output + delay, output, (num_frames - delay) * sizeof(float));
+            memcpy(output, line, delay * sizeof(float));
+        } else {
+            memcpy(tail, line + num_frames, (delay - num_frames) * sizeof(float));
+            memcpy(tail + delay - num_frames, output, num_frames * sizeof(float));
+            memcpy(output, line, num_frames * sizeof(float));
+        }
+        memcpy(line, tail, delay * sizeof(float));
+    }
+}
+
+/**
+   Whether the tremulant or the wind model bends the pitch of the pipes.
+*/
+static bool
+is_pitch_modulated(const toccata_synth_t* synth)
+{
+    if (synth->tremulant_depth > 0.0f || synth->tremulant_level != 1.0f || synth->wind_model)
+        return true;
+    for (int division = 0; division < TOCCATA_NUM_DIVISIONS; ++division) {
+        if (synth->wind_pressures[division] != 1.0f)
+            return true;
+    }
+    return false;
+}
+
+static void
+render_frames(toccata_synth_t* synth, float** outputs, int offset, int num_frames)
+{
+    while (num_frames > 0) {
+        float* segment[NUM_OUTPUT_CHANNELS];
+        for (int c = 0; c < NUM_OUTPUT_CHANNELS; ++c)
+            segment[c] = outputs[c] ? outputs[c] + offset : NULL;
+
+        int max_block = synth->samples_per_block / synth->oversampling;
+        if (is_pitch_modulated(synth) && max_block > MODULATION_SEGMENT_SIZE / synth->oversampling)
+            max_block = MODULATION_SEGMENT_SIZE / synth->oversampling;
+
+        const int block = num_frames < max_block ? num_frames : max_block;
+        if (synth->oversampling > 1) {
+            render_oversampled(synth, segment, block);
+        } else {
+            render_segment(synth, segment, block);
+            delay_segment(synth, segment, block);
+        }
+        offset += block;
+        num_frames -= block;
+    }
+}
+
+void
+toccata_synth_render_block(toccata_synth_t* synth, float** buffers, int num_frames)
+{
+    float* outputs[NUM_OUTPUT_CHANNELS];
+    for (int c = 0; c < NUM_OUTPUT_CHANNELS; ++c) {
+        outputs[c] = synth->outputs_used[c / NUM_CHANNELS] ? buffers[c] : NULL;
+        if (outputs[c])
+            memset(outputs[c], 0, num_frames * sizeof(float));
+    }
+
+    // The filter starts empty, and takes over once its history is rendered.
+    // Until then, the plain decimation goes on from the frames left in the
+    // delay line, which stand on the even frames of the history.
+    if (synth->target_oversampling > synth->oversampling) {
+        set_render_oversampling(synth, synth->target_oversampling);
+        for (int c = 0; c < NUM_OUTPUT_CHANNELS; ++c) {
+            float* history = synth->oversampled + c * OVERSAMPLED_FRAMES(synth->samples_per_block);
+            memset(history, 0, TOCCATA_DECIMATOR_HISTORY * sizeof(float));
+            for (int i = 0; i < TOCCATA_DECIMATOR_DELAY; ++i)
+                history[TOCCATA_DECIMATOR_HISTORY - TOCCATA_MAX_OVERSAMPLING * (TOCCATA_DECIMATOR_DELAY - i)] = synth->delay_lines[c][i];
+        }
+        synth->decimator_mix = 0.0f;
+        synth->decimator_warmup = TOCCATA_DECIMATOR_HISTORY / TOCCATA_MAX_OVERSAMPLING;
+    }
+
+    // Render up to each event, then apply it
+    int frame = 0;
+    for (int i = 0; i < synth->num_events; ++i) {
+        const toccata_event_t* event = &synth->events[i];
+        const int delay = event->delay < num_frames ? event->delay : num_frames;
+        if (delay > frame) {
+            render_frames(synth, outputs, frame, delay - frame);
+            frame = delay;
+        }
+        handle_event(synth, event);
+    }
+    synth->num_events = 0;
+    render_frames(synth, outputs, frame, num_frames - frame);
+}
+
+bool
+toccata_synth_lock_memory(toccata_synth_t* synth)
+{
+    synth->memory_locked = true;
+
+    bool locked = true;
+    for (int rank = 0; rank < TOCCATA_NUM_RANKS; ++rank) {
+        for (int table = 0; table < TOCCATA_TABLES_PER_RANK; ++table) {
+            locked &= toccata_wavetable_lock(&synth->tables[rank][table]);
+            locked &= toccata_wavetable_lock(&synth->attack_tables[rank][table]);
+        }
+        for (int k = 0; k < TOCCATA_NUM_KEYS; ++k) {
+            locked &= toccata_wavetable_lock(&synth->crossfades[rank][k]);
+            locked &= toccata_wavetable_lock(&synth->attack_crossfades[rank][k]);
+        }
+    }
+    locked &= toccata_lock_buffer(synth->voices, synth->num_voices * sizeof(toccata_voice_t), &synth->voices_locked);
+    locked &= toccata_lock_buffer(synth->active_voices, synth->num_voices * sizeof(int), &synth->active_voices_locked);
+    locked &= toccata_lock_buffer(synth->stop_buses, STOP_BUSES_SIZE(synth->samples_per_block), &synth->stop_buses_locked);
+    locked &= toccata_lock_buffer(synth->envelope, ENVELOPE_SIZE(synth->samples_per_block), &synth->envelope_locked);
+    locked &= toccata_lock_buffer(synth->oversampled, OVERSAMPLED_SIZE(synth->samples_per_block),
+        &synth->oversampled_locked);
+    return locked;
+}
+
+void
+toccata_synth_unlock_memory(toccata_synth_t* synth)
+{
+    // Only the buffers that were actually locked are unlocked
+    for (int rank = 0; rank < TOCCATA_NUM_RANKS; ++rank) {
+        for (int table = 0; table < TOCCATA_TABLES_PER_RANK; ++table) {
+            toccata_wavetable_unlock(&synth->tables[rank][table]);
+            toccata_wavetable_unlock(&synth->attack_tables[rank][table]);
+        }
+        for (int k = 0; k < TOCCATA_NUM_KEYS; ++k) {
+            toccata_wavetable_unlock(&synth->crossfades[rank][k]);
+            toccata_wavetable_unlock(&synth->attack_crossfades[rank][k]);
+        }
+    }
+    toccata_unlock_buffer(synth->voices, synth->num_voices * sizeof(toccata_voice_t), &synth->voices_locked);
+    toccata_unlock_buffer(synth->active_voices, synth->num_voices * sizeof(int), &synth->active_voices_locked);
+    toccata_unlock_buffer(synth->stop_buses, STOP_BUSES_SIZE(synth->samples_per_block), &synth->stop_buses_locked);
+    toccata_unlock_buffer(synth->envelope, ENVELOPE_SIZE(synth->samples_per_block), &synth->envelope_locked);
+    toccata_unlock_buffer(synth->oversampled, OVERSAMPLED_SIZE(synth->samples_per_block), &synth->oversampled_locked);
+    synth->memory_locked = false;
+}
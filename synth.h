@@ -0,0 +1,234 @@
+/*
+  Toccata LV2 plugin
+
+  Copyright 2020, Paul Ferrand <paul@ferrand.cc>
+
+  Permission to use, copy, modify, and/or distribute this software for any
+  purpose with or without fee is hereby granted, provided that the above
+  copyright notice and this permission notice appear in all copies.
+
+  THIS SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#ifndef TOCCATA_SYNTH_H
+#define TOCCATA_SYNTH_H
+
+#include "organ.h"
+#include "pool.h"
+#include "voicing.h"
+
+#include <stdbool.h>
+
+/**
+   Highest factor of toccata_synth_set_oversampling().
+*/
+#define TOCCATA_MAX_OVERSAMPLING 2
+
+/**
+   Highest number of threads for toccata_synth_set_thread_pool().
+*/
+#define TOCCATA_MAX_RENDER_THREADS 8
+
+/**
+   The main output, followed by one output per group of ranks.
+*/
+#define TOCCATA_NUM_OUTPUTS (1 + TOCCATA_NUM_GROUPS)
+
+/**
+   Oscillator interpolation, from the cheapest to the cleanest.
+*/
+enum {
+    TOCCATA_QUALITY_NEAREST = 0,
+    TOCCATA_QUALITY_LINEAR,
+    TOCCATA_QUALITY_CUBIC
+};
+
+/**
+   Wavetable organ engine, built directly from the native description in
+   organ.h. The API follows the sfizz one it replaces: events are sent
+   with a delay in frames into the next block, and are applied at that
+   frame by toccata_synth_render_block().
+*/
+typedef struct toccata_synth_t toccata_synth_t;
+
+toccata_synth_t* toccata_synth_create(void);
+void toccata_synth_free(toccata_synth_t* synth);
+
+/**
+   Load the tables of every rank from `directory`, which must end with a
+   path separator, and voice the pipes after `voicing`.
+*/
+bool toccata_synth_load(toccata_synth_t* synth, const char* directory, const toccata_voicing_t* voicing);
+
+/**
+   Every pipe of the organ has its own voice; the overflow voices only play
+   the release tails of repeated notes, and are the only ones stolen.
+*/
+bool toccata_synth_set_num_overflow_voices(toccata_synth_t* synth, int num_overflow_voices);
+void toccata_synth_set_sample_rate(toccata_synth_t* synth, float sample_rate);
+bool toccata_synth_set_samples_per_block(toccata_synth_t* synth, int samples_per_block);
+
+/**
+   Render buffers for a given block size. They can be allocated and freed
+   off the audio thread, and swapped in by the audio thread at a block
+   boundary, to resize the synth without a dropout.
+*/
+typedef struct toccata_synth_buffers_t toccata_synth_buffers_t;
+
+toccata_synth_buffers_t* toccata_synth_create_buffers(int samples_per_block, bool lock);
+void toccata_synth_free_buffers(toccata_synth_buffers_t* buffers);
+
+/**
+   Use `buffers` for rendering, and return the previous ones in the same
+   object so that they can be freed off the audio thread. Real-time safe.
+*/
+toccata_synth_buffers_t* toccata_synth_swap_buffers(toccata_synth_t* synth, toccata_synth_buffers_t* buffers);
+
+/**
+   Tables that play the sustained sound of a whole registration with one
+   voice per key and division. They are built off the audio thread for
+   given stop gains, and swapped in by the audio thread; held keys switch to
+   them once their pipes reach the sustain level, and back to the pipes when
+   a merged stop changes gain.
+*/
+typedef struct toccata_registration_t toccata_registration_t;
+
+toccata_registration_t* toccata_synth_create_registration(const toccata_synth_t* synth,
+    const float* stop_gains, const int* rank_outputs, bool lock);
+void toccata_synth_free_registration(toccata_registration_t* registration);
+
+/**
+   Use `registration`, and return the previous one so that it can be freed
+   off the audio thread. Real-time safe.
+*/
+toccata_registration_t* toccata_synth_swap_registration(toccata_synth_t* synth,
+    toccata_registration_t* registration);
+
+/**
+   Returns true if the stop gains or rank outputs differ from those of the
+   registration.
+*/
+bool toccata_synth_registration_changed(const toccata_synth_t* synth);
+float toccata_synth_get_stop_gain(const toccata_synth_t* synth, int stop);
+
+/**
+   Notes and controllers address one of the TOCCATA_NUM_DIVISIONS
+   divisions; stops are numbered with TOCCATA_STOP().
+*/
+void toccata_synth_note_on(toccata_synth_t* synth, int delay, int division, int key, int velocity);
+void toccata_synth_note_off(toccata_synth_t* synth, int delay, int division, int key, int velocity);
+void toccata_synth_cc(toccata_synth_t* synth, int delay, int division, int cc, int value);
+void toccata_synth_set_stop_gain(toccata_synth_t* synth, int delay, int stop, float gain);
+
+/**
+   Set the expression of the swell box around TOCCATA_ENCLOSED_DIVISION,
+   from closed at 0 to open at 1, like CC 11 on the channel of that
+   division does.
+*/
+void toccata_synth_set_swell(toccata_synth_t* synth, int delay, float value);
+
+/**
+   Move the crescendo pedal, from 0 to 1, like CC 4 on any division does.
+   The pedal steps through `toccata_crescendo`, whose stops sound on top of
+   the drawn ones; toccata_synth_get_stop_gain() returns the gains that
+   sound.
+*/
+void toccata_synth_set_crescendo(toccata_synth_t* synth, int delay, float value);
+
+/**
+   Send a rank to one of the TOCCATA_NUM_OUTPUTS outputs, 0 being the main
+   one. Only the ranks of one output are merged. Real-time safe.
+*/
+void toccata_synth_set_rank_output(toccata_synth_t* synth, int rank, int output);
+int toccata_synth_get_rank_output(const toccata_synth_t* synth, int rank);
+
+/**
+   Render the voices on up to `num_threads` threads, the calling thread
+   and those of `pool`, split by stop. Use a NULL pool or a single thread
+   to render on the calling thread only. The pool must outlive its use by
+   the synth. Real-time safe.
+*/
+void toccata_synth_set_thread_pool(toccata_synth_t* synth, toccata_pool_t* pool, int num_threads);
+
+/**
+   Render the segments of exactly `block_size` frames with kernels
+   specialized for that size, if there are some, for hosts that guarantee
+   a fixed power-of-two block. Use 0 to go back to the generic kernels.
+   Real-time safe.
+*/
+void toccata_synth_set_fixed_block_size(toccata_synth_t* synth, int block_size);
+
+/**
+   Render the voices at `factor` times the sample rate, 1 or
+   TOCCATA_MAX_OVERSAMPLING, and decimate them through a halfband filter.
+   The change crossfades over a few milliseconds from the next block on,
+   while the voices keep playing. Real-time safe.
+*/
+void toccata_synth_set_oversampling(toccata_synth_t* synth, int factor);
+
+/**
+   Delay of the output in frames. The rendering at the sample rate is
+   delayed as much as the decimator, so that it never changes and the
+   oversampling switches without dropping or repeating frames. Real-time
+   safe.
+*/
+int toccata_synth_get_latency(const toccata_synth_t* synth);
+
+/**
+   Set the interpolation used by the voices of a rank, from the next
+   block on. Real-time safe.
+*/
+void toccata_synth_set_rank_quality(toccata_synth_t* synth, int rank, int quality);
+
+/**
+   Stop gain changes, from toccata_synth_set_stop_gain() or from MIDI,
+   ramp linearly to their target over `seconds`. Real-time safe.
+*/
+void toccata_synth_set_gain_smoothing(toccata_synth_t* synth, float seconds);
+
+/**
+   Set the tremulant, a periodic swing of the wind that modulates the
+   amplitude and the pitch of all the pipes at `rate` Hz. A `depth` of 0
+   turns it off, and 1 is the deepest. Real-time safe.
+*/
+void toccata_synth_set_tremulant(toccata_synth_t* synth, float rate, float depth);
+
+/**
+   Enable the wind model, where the pipes held in a division lower its
+   wind pressure, which slightly flattens their pitch and loudness.
+   Real-time safe.
+*/
+void toccata_synth_set_wind_model(toccata_synth_t* synth, bool enabled);
+void toccata_synth_all_sound_off(toccata_synth_t* synth);
+int toccata_synth_get_num_active_voices(const toccata_synth_t* synth);
+
+/**
+   Take over the stop gains, the rank outputs, the sustain pedals and the held
+   notes of `source`, whose notes are restarted at the start of the next
+   block. Real-time safe.
+*/
+void toccata_synth_copy_state(toccata_synth_t* synth, const toccata_synth_t* source);
+
+/**
+   Render a block into a stereo pair of `buffers` per output, which may be
+   NULL for the outputs other than the main one that no rank is sent to.
+   `num_frames` may be larger than the block size set with
+   toccata_synth_set_samples_per_block(), in which case the block is
+   rendered in several passes.
+*/
+void toccata_synth_render_block(toccata_synth_t* synth, float** buffers, int num_frames);
+
+/**
+   Pre-fault and try to lock the wavetables, voices and render buffers in
+   memory. Returns false if some of them could only be pre-faulted.
+*/
+bool toccata_synth_lock_memory(toccata_synth_t* synth);
+void toccata_synth_unlock_memory(toccata_synth_t* synth);
+
+#endif // TOCCATA_SYNTH_H
@@ -41,35 +41,47 @@
 #include "lv2/log/logger.h"
 #include "lv2/log/log.h"
 
+#include "organ.h"
+#include "reverb.h"
+#include "synth.h"
+#include "voicing.h"
+#include "watcher.h"
+
 #include <math.h>
-#include <sfizz.h>
 #include <stdbool.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <time.h>
+#endif
 
-#define DEFAULT_SFZ_FILE ""
 #define TOCCATA_URI "https://github.com/sfztools/toccata"
-#define TOCCATA_SFZ_PATH "instrument/organ.sfz"
+#define TOCCATA_INSTRUMENT_PATH "instrument/"
+#define MAX_PATH_SIZE 1024
 #define CHANNEL_MASK 0x0F
 #define NOTE_ON 0x90
 #define NOTE_OFF 0x80
 #define MIDI_CHANNEL(byte) (byte & CHANNEL_MASK)
 #define MIDI_STATUS(byte) (byte & ~CHANNEL_MASK)
 #define MAX_BLOCK_SIZE 8192
-#define MAX_PATH_SIZE 1024
-#define NUM_VOICES 256
+#define NUM_OVERFLOW_VOICES 128
+#define FADE_CHUNK_SIZE 256
+// Stops must stay put this long before the registration is merged
+#define REGISTRATION_SETTLE_TIME 0.05
+// The governor lowers the quality above the high load, and restores it once
+// the load stayed below the low one for the hold time
+#define GOVERNOR_HIGH_LOAD 0.7
+#define GOVERNOR_LOW_LOAD 0.35
+#define GOVERNOR_HOLD_TIME 0.5
+// Time left after a step for the load measurement to catch up
+#define GOVERNOR_COOLDOWN_TIME 0.1
+#define GOVERNOR_LOAD_SMOOTHING 0.2
+#define NUM_OUTPUT_CHANNELS (2 * TOCCATA_NUM_OUTPUTS)
 #define UNUSED(x) (void)(x)
 
-#define TOCCATA_BOURDON16_CC 100
-#define TOCCATA_FLUTE8_CC 101
-#define TOCCATA_MONTRE8_CC 102
-#define TOCCATA_FLUTE4_CC 103
-#define TOCCATA_PRESTANT4_CC 104
-#define TOCCATA_DOUBLETTE2_CC 105
-#define TOCCATA_PLEINJEUX_CC 106
-#define TOCCATA_SESQUIALTERA_CC 107
-#define TOCCATA_TROMPETTE8_CC 108
-
 enum {
     INPUT_PORT = 0,
     LEFT_BUFFER,
@@ -83,39 +95,114 @@ enum {
     DOUBLETTE2_PORT,
     PLEINJEUX_PORT,
     SESQUIALTERA_PORT,
-    TROMPETTE8_PORT
+    TROMPETTE8_PORT,
+    HOT_RELOAD_PORT,
+    STOP_SMOOTHING_PORT,
+    QUALITY_PORT,
+    GOVERNOR_PORT,
+    RENDER_THREADS_PORT,
+    LOOKAHEAD_PORT,
+    LATENCY_PORT,
+    FLUES_LEFT_BUFFER,
+    FLUES_RIGHT_BUFFER,
+    REEDS_LEFT_BUFFER,
+    REEDS_RIGHT_BUFFER,
+    // The stops of the other divisions, in the order of the ranks
+    POSITIVE_STOPS_PORT,
+    PEDAL_STOPS_PORT = POSITIVE_STOPS_PORT + TOCCATA_NUM_RANKS,
+    GREAT_CHANNEL_PORT = PEDAL_STOPS_PORT + TOCCATA_NUM_RANKS,
+    POSITIVE_CHANNEL_PORT,
+    PEDAL_CHANNEL_PORT,
+    TREMULANT_RATE_PORT,
+    TREMULANT_DEPTH_PORT,
+    WIND_MODEL_PORT,
+    SWELL_PORT,
+    CRESCENDO_PORT,
+    REVERB_MIX_PORT,
+    REVERB_ROOM_PORT
 };
 
+typedef enum {
+    WORK_RELOAD, ///< Build a new synth from the instrument directory
+    WORK_SWAP_SYNTH, ///< Response carrying the new synth
+    WORK_FREE_SYNTH, ///< Free a synth that was swapped out
+    WORK_RESIZE, ///< Allocate render buffers for a new block size
+    WORK_SWAP_BUFFERS, ///< Response carrying the new buffers
+    WORK_FREE_BUFFERS, ///< Free buffers that were swapped out
+    WORK_MERGE, ///< Merge the registration of a synth
+    WORK_SWAP_REGISTRATION, ///< Response carrying the merged registration
+    WORK_FREE_REGISTRATION, ///< Free a registration that was swapped out
+    WORK_CREATE_POOL, ///< Start the render threads
+    WORK_SWAP_POOL, ///< Response carrying the new pool
+    WORK_FREE_POOL, ///< Stop the threads of a pool that was swapped out
+    WORK_CREATE_LOOKAHEAD, ///< Start the lookahead thread and its buffers
+    WORK_SWAP_LOOKAHEAD, ///< Response carrying the new lookahead
+    WORK_FREE_LOOKAHEAD, ///< Stop a lookahead that was swapped out
+    WORK_CREATE_REVERB, ///< Load the rooms for a new sample rate or block size
+    WORK_SWAP_REVERB, ///< Response carrying the new reverb
+    WORK_FREE_REVERB ///< Free a reverb that was swapped out
+} toccata_work_type_t;
+
+/**
+   Renders one block ahead on its own thread. The output is read from the
+   start of the buffers, and the thread renders the next frames at their
+   end, `latency` frames later.
+*/
+typedef struct
+{
+    toccata_pool_t* pool;
+    int latency;
+    float* buffers[NUM_OUTPUT_CHANNELS]; ///< `latency` frames each
+} toccata_lookahead_t;
+
+typedef struct
+{
+    toccata_work_type_t type;
+    toccata_synth_t* synth;
+    toccata_synth_buffers_t* buffers;
+    toccata_registration_t* registration;
+    toccata_pool_t* pool;
+    int num_threads;
+    toccata_lookahead_t* lookahead;
+    toccata_reverb_t* reverb;
+    float stop_gains[TOCCATA_NUM_STOPS];
+    int rank_outputs[TOCCATA_NUM_RANKS];
+    double sample_rate;
+    int block_size;
+} toccata_work_t;
+
 typedef struct
 {
     // Features
     LV2_URID_Map* map;
     LV2_URID_Unmap* unmap;
     LV2_Log_Log* log;
+    LV2_Worker_Schedule* worker;
 
     // Ports
     const LV2_Atom_Sequence* input_port;
-    float *output_buffers[2];
+    float *output_buffers[NUM_OUTPUT_CHANNELS]; ///< The main pair, then one pair per group
     const float *freewheel_port;
-    const float *bourdon16_port;
-    const float *flute8_port;
-    const float *montre8_port;
-    const float *flute4_port;
-    const float *prestant4_port;
-    const float *doublette2_port;
-    const float *pleinjeux_port;
-    const float *sesquialtera_port;
-    const float *trompette8_port;
-
-    float bourdon16_gain;
-    float flute8_gain;
-    float montre8_gain;
-    float flute4_gain;
-    float prestant4_gain;
-    float doublette2_gain;
-    float pleinjeux_gain;
-    float sesquialtera_gain;
-    float trompette8_gain;
+    const float *stop_ports[TOCCATA_NUM_STOPS]; ///< Numbered by TOCCATA_STOP()
+    const float *hot_reload_port;
+    const float *stop_smoothing_port; ///< In milliseconds
+    const float *tremulant_rate_port; ///< In Hz
+    const float *tremulant_depth_port;
+    const float *wind_model_port;
+    const float *swell_port;
+    const float *crescendo_port;
+    const float *reverb_mix_port;
+    const float *reverb_room_port;
+    const float *quality_port;
+    const float *governor_port;
+    const float *render_threads_port;
+    const float *lookahead_port;
+    float *latency_port;
+    const float *channel_ports[TOCCATA_NUM_DIVISIONS]; ///< MIDI channels, from 1
+
+    float stop_values[TOCCATA_NUM_STOPS]; ///< Last values seen on the stop ports
+    float swell_value; ///< Last value seen on the swell port, which CC 11 can override
+    float crescendo_value; ///< Last value seen on the crescendo port, which CC 4 can override
 
     // Atom forge
     LV2_Atom_Forge forge; ///< Forge for writing atoms in run thread
@@ -131,6 +218,10 @@ typedef struct
     LV2_URID nominal_block_length_uri;
     LV2_URID sample_rate_uri;
     LV2_URID atom_object_uri;
+    LV2_URID patch_set_uri;
+    LV2_URID patch_property_uri;
+    LV2_URID patch_value_uri;
+    LV2_URID stop_uris[TOCCATA_NUM_RANKS]; ///< Parameters of the Great stops
     LV2_URID atom_float_uri;
     LV2_URID atom_int_uri;
     LV2_URID atom_urid_uri;
@@ -138,10 +229,50 @@ typedef struct
     LV2_URID atom_bool_uri;
 
     bool activated;
-    int max_block_size;
-    double sample_rate;
-    // Sfizz related data
-    sfizz_synth_t *synth;
+    bool freewheeling; ///< Rendering offline, at the highest quality
+    int max_block_size; ///< Requested by the host
+    double sample_rate; ///< Requested by the host
+    int synth_block_size; ///< Size of the synth buffers
+    bool fixed_block_size; ///< Every block is `max_block_size` frames, a power of 2
+    double synth_sample_rate;
+    bool resize_pending; ///< New buffers are being allocated by the worker
+    char* instrument_path;
+    // Synth related data
+    toccata_synth_t *synth;
+    toccata_reverb_t* reverb; ///< On the main outputs, or NULL if the rooms could not be loaded
+    bool reverb_pending; ///< A new reverb is being built by the worker
+    double reverb_sample_rate;
+    int reverb_block_size;
+
+    // Hot reload
+    toccata_watcher_t* watcher;
+    bool reload_requested;
+    bool reload_pending; ///< A new synth is being built by the worker
+    toccata_synth_t* fading_synth; ///< Old synth, faded out during the next block
+    float fade_buffers[NUM_OUTPUT_CHANNELS][FADE_CHUNK_SIZE];
+
+    // Merged registration
+    bool merge_pending;
+    float settling_gains[TOCCATA_NUM_STOPS];
+    int settled_frames;
+
+    // Render threads, started by the worker
+    toccata_pool_t* pool;
+    bool pool_pending;
+    int max_render_threads; ///< Lowered if the threads could not be started
+
+    // Lookahead, started by the worker
+    toccata_lookahead_t* lookahead;
+    bool lookahead_pending;
+    bool groups_routed[TOCCATA_NUM_GROUPS]; ///< To their own outputs
+    int lookahead_frames; ///< Being rendered ahead, or 0
+    double lookahead_time; ///< Taken by the last render ahead, in seconds
+
+    // Quality governor
+    double load; ///< Smoothed ratio of the run() time to the block duration
+    int quality_reduction; ///< Steps of one rank by one quality level
+    int governor_cooldown; ///< Frames before the next reduction
+    int governor_calm_frames; ///< Frames spent below the low load
 } toccata_plugin_t;
 
 static float clamp_gain(float gain)
@@ -151,6 +282,76 @@ static float clamp_gain(float gain)
     return gain;
 }
 
+/**
+   Build a synth from the tables and the voicing of the instrument directory.
+*/
+static toccata_synth_t*
+create_synth(toccata_plugin_t* self, double sample_rate, int block_size)
+{
+    char path[MAX_PATH_SIZE];
+    toccata_voicing_t voicing;
+    int error_line;
+    toccata_voicing_init(&voicing);
+    snprintf(path, MAX_PATH_SIZE, "%s%s", self->instrument_path, TOCCATA_VOICING_FILE);
+    if (!toccata_voicing_load(&voicing, path, &error_line)) {
+        if (error_line > 0)
+            lv2_log_error(&self->logger, "Invalid voicing in %s, line %d\n", path, error_line);
+        else
+            lv2_log_error(&self->logger, "Could not read the voicing of every table from %s\n", path);
+        return NULL;
+    }
+
+    toccata_synth_t* synth = toccata_synth_create();
+    if (!synth
+        || !toccata_synth_set_num_overflow_voices(synth, NUM_OVERFLOW_VOICES)
+        || !toccata_synth_set_samples_per_block(synth, block_size)) {
+        lv2_log_error(&self->logger, "Could not allocate the synth\n");
+        toccata_synth_free(synth);
+        return NULL;
+    }
+    toccata_synth_set_sample_rate(synth, (float)sample_rate);
+
+    if (!toccata_synth_load(synth, self->instrument_path, &voicing)) {
+        lv2_log_error(&self->logger, "Could not load the wavetables from %s\n", self->instrument_path);
+        toccata_synth_free(synth);
+        return NULL;
+    }
+    return synth;
+}
+
+static void
+free_lookahead(toccata_lookahead_t* lookahead)
+{
+    if (!lookahead)
+        return;
+
+    toccata_pool_free(lookahead->pool);
+    for (int channel = 0; channel < NUM_OUTPUT_CHANNELS; ++channel)
+        free(lookahead->buffers[channel]);
+    free(lookahead);
+}
+
+static toccata_lookahead_t*
+create_lookahead(int block_size)
+{
+    toccata_lookahead_t* lookahead = (toccata_lookahead_t*)calloc(1, sizeof(toccata_lookahead_t));
+    if (!lookahead)
+        return NULL;
+
+    lookahead->latency = block_size;
+    lookahead->pool = toccata_pool_create(1);
+    bool allocated = lookahead->pool != NULL;
+    for (int channel = 0; channel < NUM_OUTPUT_CHANNELS; ++channel) {
+        lookahead->buffers[channel] = (float*)calloc(block_size, sizeof(float));
+        allocated &= lookahead->buffers[channel] != NULL;
+    }
+    if (!allocated) {
+        free_lookahead(lookahead);
+        return NULL;
+    }
+    return lookahead;
+}
+
 static void
 toccata_map_required_uris(toccata_plugin_t* self)
 {
@@ -164,6 +365,16 @@ toccata_map_required_uris(toccata_plugin_t* self)
     self->atom_bool_uri = map->map(map->handle, LV2_ATOM__Bool);
     self->atom_string_uri = map->map(map->handle, LV2_ATOM__String);
     self->atom_urid_uri = map->map(map->handle, LV2_ATOM__URID);
+    self->atom_object_uri = map->map(map->handle, LV2_ATOM__Object);
+    self->patch_set_uri = map->map(map->handle, LV2_PATCH__Set);
+    self->patch_property_uri = map->map(map->handle, LV2_PATCH__property);
+    self->patch_value_uri = map->map(map->handle, LV2_PATCH__value);
+
+    char uri[256];
+    for (int rank = 0; rank < TOCCATA_NUM_RANKS; ++rank) {
+        snprintf(uri, sizeof(uri), "%s#%s", TOCCATA_URI, toccata_ranks[rank].symbol);
+        self->stop_uris[rank] = map->map(map->handle, uri);
+    }
 }
 
 static void
@@ -185,34 +396,46 @@ connect_port(LV2_Handle instance,
     case FREEWHEEL_PORT:
         self->freewheel_port = (const float *)data;
         break;
-    case BOURDON16_PORT:
-        self->bourdon16_port = (const float*)data;
-        break;
-    case FLUTE8_PORT:
-        self->flute8_port = (const float*)data;
-        break;
-    case MONTRE8_PORT:
-        self->montre8_port = (const float*)data;
-        break;
-    case PRESTANT4_PORT:
-        self->prestant4_port = (const float*)data;
-        break;
-    case FLUTE4_PORT:
-        self->flute4_port = (const float*)data;
-        break;
-    case DOUBLETTE2_PORT:
-        self->doublette2_port = (const float*)data;
-        break;
-    case PLEINJEUX_PORT:
-        self->pleinjeux_port = (const float*)data;
-        break;
-    case SESQUIALTERA_PORT:
-        self->sesquialtera_port = (const float*)data;
-        break;
-    case TROMPETTE8_PORT:
-        self->trompette8_port = (const float*)data;
-        break;
     default:
+        // The stop ports follow the order of the ranks in the organ description
+        if (port >= BOURDON16_PORT && port <= TROMPETTE8_PORT)
+            self->stop_ports[TOCCATA_STOP(TOCCATA_DIVISION_GREAT, port - BOURDON16_PORT)] = (const float*)data;
+        else if (port >= POSITIVE_STOPS_PORT && port < PEDAL_STOPS_PORT)
+            self->stop_ports[TOCCATA_STOP(TOCCATA_DIVISION_POSITIVE, port - POSITIVE_STOPS_PORT)] = (const float*)data;
+        else if (port >= PEDAL_STOPS_PORT && port < GREAT_CHANNEL_PORT)
+            self->stop_ports[TOCCATA_STOP(TOCCATA_DIVISION_PEDAL, port - PEDAL_STOPS_PORT)] = (const float*)data;
+        else if (port >= GREAT_CHANNEL_PORT && port <= PEDAL_CHANNEL_PORT)
+            self->channel_ports[port - GREAT_CHANNEL_PORT] = (const float*)data;
+        else if (port >= FLUES_LEFT_BUFFER && port <= REEDS_RIGHT_BUFFER)
+            self->output_buffers[2 + port - FLUES_LEFT_BUFFER] = (float*)data;
+        else if (port == HOT_RELOAD_PORT)
+            self->hot_reload_port = (const float*)data;
+        else if (port == STOP_SMOOTHING_PORT)
+            self->stop_smoothing_port = (const float*)data;
+        else if (port == TREMULANT_RATE_PORT)
+            self->tremulant_rate_port = (const float*)data;
+        else if (port == TREMULANT_DEPTH_PORT)
+            self->tremulant_depth_port = (const float*)data;
+        else if (port == WIND_MODEL_PORT)
+            self->wind_model_port = (const float*)data;
+        else if (port == SWELL_PORT)
+            self->swell_port = (const float*)data;
+        else if (port == CRESCENDO_PORT)
+            self->crescendo_port = (const float*)data;
+        else if (port == REVERB_MIX_PORT)
+            self->reverb_mix_port = (const float*)data;
+        else if (port == REVERB_ROOM_PORT)
+            self->reverb_room_port = (const float*)data;
+        else if (port == QUALITY_PORT)
+            self->quality_port = (const float*)data;
+        else if (port == GOVERNOR_PORT)
+            self->governor_port = (const float*)data;
+        else if (port == RENDER_THREADS_PORT)
+            self->render_threads_port = (const float*)data;
+        else if (port == LOOKAHEAD_PORT)
+            self->lookahead_port = (const float*)data;
+        else if (port == LATENCY_PORT)
+            self->latency_port = (float*)data;
         break;
     }
 }
@@ -228,7 +451,7 @@ instantiate(const LV2_Descriptor* descriptor,
     bool supports_bounded_block_size = false;
     bool options_has_block_size = false;
     bool supports_fixed_block_size = false;
-    char* full_path;
+    bool supports_power_of_2_block_size = false;
 
     // Allocate and initialise instance structure.
     toccata_plugin_t* self = (toccata_plugin_t*)calloc(1, sizeof(toccata_plugin_t));
@@ -237,17 +460,13 @@ instantiate(const LV2_Descriptor* descriptor,
 
     // Set defaults
     self->max_block_size = MAX_BLOCK_SIZE;
+    self->max_render_threads = TOCCATA_MAX_RENDER_THREADS;
     self->sample_rate = rate;
     self->activated = false;
-    self->bourdon16_gain = 0.0f;
-    self->flute8_gain = 0.0f;
-    self->montre8_gain = 0.0f;
-    self->flute4_gain = 0.0f;
-    self->prestant4_gain = 0.0f;
-    self->doublette2_gain = 0.0f;
-    self->pleinjeux_gain = 0.0f;
-    self->sesquialtera_gain = 0.0f;
-    self->trompette8_gain = 0.0f;
+    for (int stop = 0; stop < TOCCATA_NUM_STOPS; ++stop)
+        self->stop_values[stop] = 0.0f;
+    self->swell_value = 1.0f;
+    self->crescendo_value = 0.0f;
 
     // Get the features from the host and populate the structure
     for (const LV2_Feature* const* f = features; *f; f++) {
@@ -264,11 +483,17 @@ instantiate(const LV2_Descriptor* descriptor,
         if (!strcmp((**f).URI, LV2_BUF_SIZE__fixedBlockLength))
             supports_fixed_block_size = true;
 
+        if (!strcmp((**f).URI, LV2_BUF_SIZE__powerOf2BlockLength))
+            supports_power_of_2_block_size = true;
+
         if (!strcmp((**f).URI, LV2_OPTIONS__options))
             options = (**f).data;
 
         if (!strcmp((**f).URI, LV2_LOG__log))
             self->log = (**f).data;
+
+        if (!strcmp((**f).URI, LV2_WORKER__schedule))
+            self->worker = (**f).data;
     }
 
     // Setup the loggers
@@ -325,19 +550,39 @@ instantiate(const LV2_Descriptor* descriptor,
         return NULL;
     }
 
-    self->synth = sfizz_create_synth();
-    sfizz_set_num_voices(self->synth, NUM_VOICES);
-    sfizz_set_sample_rate(self->synth, self->sample_rate);
-    sfizz_set_samples_per_block(self->synth, self->max_block_size);
-    full_path = calloc(1, strlen(path) + strlen(TOCCATA_SFZ_PATH) + 1);
-    strcpy(full_path, path);
-    strcat(full_path, TOCCATA_SFZ_PATH);
-    bool file_loaded = sfizz_load_file(self->synth, full_path);
-    free(full_path);
+    self->instrument_path = calloc(1, strlen(path) + strlen(TOCCATA_INSTRUMENT_PATH) + 1);
+    if (!self->instrument_path) {
+        free(self);
+        return NULL;
+    }
+    strcpy(self->instrument_path, path);
+    strcat(self->instrument_path, TOCCATA_INSTRUMENT_PATH);
 
-    if (!file_loaded)
+    self->synth = create_synth(self, self->sample_rate, self->max_block_size);
+    if (!self->synth) {
+        lv2_log_error(&self->logger, "Could not build the organ, aborting...\n");
+        free(self->instrument_path);
+        free(self);
         return NULL;
+    }
+
+    // The worker builds it again when the sample rate or block size change
+    self->reverb = toccata_reverb_create(self->instrument_path, (float)self->sample_rate, self->max_block_size);
+    if (!self->reverb)
+        lv2_log_warning(&self->logger, "Could not load the rooms of the reverb, it is disabled\n");
+    self->reverb_sample_rate = self->sample_rate;
+    self->reverb_block_size = self->max_block_size;
 
+    self->synth_sample_rate = self->sample_rate;
+    self->synth_block_size = self->max_block_size;
+    self->fixed_block_size = supports_fixed_block_size && supports_power_of_2_block_size;
+
+    // Hot reloading needs the worker to build the new synth
+    if (self->worker) {
+        self->watcher = toccata_watcher_create(self->instrument_path);
+        if (!self->watcher)
+            lv2_log_warning(&self->logger, "Could not start watching the instrument, hot reload is disabled\n");
+    }
 
     return (LV2_Handle)self;
 }
@@ -346,7 +591,15 @@ static void
 cleanup(LV2_Handle instance)
 {
     toccata_plugin_t* self = (toccata_plugin_t*)instance;
-    sfizz_free(self->synth);
+    if (self->lookahead_frames > 0)
+        toccata_pool_wait(self->lookahead->pool);
+    free_lookahead(self->lookahead);
+    toccata_watcher_free(self->watcher);
+    toccata_synth_free(self->synth);
+    toccata_synth_free(self->fading_synth);
+    toccata_reverb_free(self->reverb);
+    toccata_pool_free(self->pool);
+    free(self->instrument_path);
     free(self);
 }
 
@@ -354,6 +607,13 @@ static void
 activate(LV2_Handle instance)
 {
     toccata_plugin_t* self = (toccata_plugin_t*)instance;
+
+    // Map the wavetables, voices and render buffers now, rather than on the
+    // first chord in run()
+    if (!toccata_synth_lock_memory(self->synth))
+        lv2_log_note(&self->logger,
+            "Could not lock the synth memory (RLIMIT_MEMLOCK too low?), it is only pre-faulted\n");
+
     self->activated = true;
 }
 
@@ -362,60 +622,518 @@ deactivate(LV2_Handle instance)
 {
     toccata_plugin_t* self = (toccata_plugin_t*)instance;
     self->activated = false;
+
+    // The worker cannot be scheduled from here, the old synth is freed below
+    if (self->lookahead_frames > 0) {
+        toccata_pool_wait(self->lookahead->pool);
+        self->lookahead_frames = 0;
+    }
+    if (self->lookahead) {
+        for (int channel = 0; channel < NUM_OUTPUT_CHANNELS; ++channel)
+            memset(self->lookahead->buffers[channel], 0, self->lookahead->latency * sizeof(float));
+    }
+    toccata_synth_unlock_memory(self->synth);
+
+    // The next run() may be long after, there is nothing left to fade
+    if (self->fading_synth) {
+        toccata_synth_free(self->fading_synth);
+        self->fading_synth = NULL;
+    }
+}
+
+/**
+   MIDI channel of a division, from 0. Unconnected ports leave the
+   divisions on channels 1, 2 and 3.
+*/
+static int
+division_channel(const toccata_plugin_t* self, int division)
+{
+    const float* port = self->channel_ports[division];
+    if (!port)
+        return division;
+    return (int)lrintf(fminf(16.0f, fmaxf(1.0f, *port))) - 1;
 }
 
 static void
-process_midi_event(toccata_plugin_t* self, const LV2_Atom_Event* ev)
+process_division_midi_event(toccata_plugin_t* self, const LV2_Atom_Event* ev, int division)
 {
     const uint8_t* const msg = (const uint8_t*)(ev + 1);
     switch (lv2_midi_message_type(msg)) {
     case LV2_MIDI_MSG_NOTE_ON:
         if (msg[2] == 0)
             goto noteoff; // 0 velocity note-ons should be forbidden but just in case...
-        sfizz_send_note_on(self->synth,
-                           (int)ev->time.frames,
-                           (int)msg[1],
-                           msg[2]);
+        toccata_synth_note_on(self->synth,
+                              (int)ev->time.frames,
+                              division,
+                              (int)msg[1],
+                              msg[2]);
         break;
     case LV2_MIDI_MSG_NOTE_OFF: noteoff:
-        sfizz_send_note_off(self->synth,
-                            (int)ev->time.frames,
-                            (int)msg[1],
-                            msg[2]);
+        toccata_synth_note_off(self->synth,
+                               (int)ev->time.frames,
+                               division,
+                               (int)msg[1],
+                               msg[2]);
         break;
     case LV2_MIDI_MSG_CONTROLLER:
-        sfizz_send_cc(self->synth,
-                      (int)ev->time.frames,
-                      (int)msg[1],
-                      msg[2]);
+        toccata_synth_cc(self->synth,
+                         (int)ev->time.frames,
+                         division,
+                         (int)msg[1],
+                         msg[2]);
         break;
     default:
         break;
     }
 }
 
+/**
+   Send a MIDI event to every division listening on its channel.
+*/
 static void
-check_freewheeling(toccata_plugin_t* self)
+process_midi_event(toccata_plugin_t* self, const LV2_Atom_Event* ev)
 {
-    if (*(self->freewheel_port) > 0)
-    {
-        sfizz_enable_freewheeling(self->synth);
+    const uint8_t* const msg = (const uint8_t*)(ev + 1);
+    const int channel = MIDI_CHANNEL(msg[0]);
+    for (int division = 0; division < TOCCATA_NUM_DIVISIONS; ++division) {
+        if (division_channel(self, division) == channel)
+            process_division_midi_event(self, ev, division);
     }
-    else
-    {
-        sfizz_disable_freewheeling(self->synth);
+}
+
+static void
+send_gain_if_necessary(toccata_plugin_t* self, int stop)
+{
+    // Ports are only read once per block, so their changes land on frame 0
+    const float* port = self->stop_ports[stop];
+    float* value = &self->stop_values[stop];
+    if (port && *port != *value) {
+        *value = *port;
+        toccata_synth_set_stop_gain(self->synth, 0, stop, clamp_gain(*port));
+    }
+}
+
+/**
+   Apply a patch:Set of a stop parameter at the frame of its event. The
+   parameters are the stops of the Great.
+*/
+static void
+process_patch_set(toccata_plugin_t* self, const LV2_Atom_Event* ev)
+{
+    const LV2_Atom_Object* obj = (const LV2_Atom_Object*)&ev->body;
+    const LV2_Atom* property = NULL;
+    const LV2_Atom* value = NULL;
+    lv2_atom_object_get(obj,
+        self->patch_property_uri, &property,
+        self->patch_value_uri, &value,
+        0);
+
+    if (!property || property->type != self->atom_urid_uri
+        || !value || value->type != self->atom_float_uri)
+        return;
+
+    const LV2_URID key = ((const LV2_Atom_URID*)property)->body;
+    for (int rank = 0; rank < TOCCATA_NUM_RANKS; ++rank) {
+        if (key == self->stop_uris[rank]) {
+            const float gain = clamp_gain(((const LV2_Atom_Float*)value)->body);
+            toccata_synth_set_stop_gain(self->synth, (int)ev->time.frames,
+                TOCCATA_STOP(TOCCATA_DIVISION_GREAT, rank), gain);
+            return;
+        }
+    }
+}
+
+static void
+schedule_work(toccata_plugin_t* self, const toccata_work_t* work)
+{
+    if (self->worker->schedule_work(self->worker->handle, sizeof(toccata_work_t), work) != LV2_WORKER_SUCCESS)
+        lv2_log_error(&self->logger, "Could not schedule work\n");
+}
+
+/**
+   Apply the options set by the host at the block boundary. The sample
+   rate only affects new voices, but the render buffers are reallocated
+   by the worker; until they are swapped in, the synth renders the block
+   in several passes. The worker also builds a reverb for the new options,
+   and the current one keeps playing meanwhile.
+*/
+static void
+apply_options(toccata_plugin_t* self)
+{
+    if (self->sample_rate != self->synth_sample_rate) {
+        toccata_synth_set_sample_rate(self->synth, (float)self->sample_rate);
+        self->synth_sample_rate = self->sample_rate;
+    }
+
+    toccata_synth_set_fixed_block_size(self->synth, self->fixed_block_size ? self->max_block_size : 0);
+
+    if (self->worker && !self->resize_pending && self->max_block_size != self->synth_block_size) {
+        const toccata_work_t work = { .type = WORK_RESIZE, .block_size = self->max_block_size };
+        if (self->worker->schedule_work(self->worker->handle, sizeof(work), &work) == LV2_WORKER_SUCCESS)
+            self->resize_pending = true;
+    }
+
+    if (self->worker && self->reverb && !self->reverb_pending
+        && (self->sample_rate != self->reverb_sample_rate || self->max_block_size != self->reverb_block_size)) {
+        const toccata_work_t work = {
+            .type = WORK_CREATE_REVERB,
+            .sample_rate = self->sample_rate,
+            .block_size = self->max_block_size
+        };
+        if (self->worker->schedule_work(self->worker->handle, sizeof(work), &work) == LV2_WORKER_SUCCESS)
+            self->reverb_pending = true;
+    }
+}
+
+/**
+   Render the synth that was swapped out over the block, fading it out.
+*/
+static void
+fade_out_old_synth(toccata_plugin_t* self, float** outputs, int num_frames)
+{
+    float* buffers[NUM_OUTPUT_CHANNELS];
+    for (int channel = 0; channel < NUM_OUTPUT_CHANNELS; ++channel)
+        buffers[channel] = self->fade_buffers[channel];
+    const float step = 1.0f / (float)num_frames;
+
+    for (int offset = 0; offset < num_frames; offset += FADE_CHUNK_SIZE) {
+        const int chunk = num_frames - offset < FADE_CHUNK_SIZE ? num_frames - offset : FADE_CHUNK_SIZE;
+        toccata_synth_render_block(self->fading_synth, buffers, chunk);
+        for (int channel = 0; channel < NUM_OUTPUT_CHANNELS; ++channel) {
+            if (channel >= 2 && !self->groups_routed[channel / 2 - 1])
+                continue;
+
+            float* output = outputs[channel] + offset;
+            for (int i = 0; i < chunk; ++i)
+                output[i] += buffers[channel][i] * (1.0f - (float)(offset + i + 1) * step);
+        }
+    }
+}
+
+static void
+render(toccata_plugin_t* self, float** outputs, int num_frames)
+{
+    toccata_synth_render_block(self->synth, outputs, num_frames);
+    if (self->fading_synth && num_frames > 0)
+        fade_out_old_synth(self, outputs, num_frames);
+    if (self->reverb)
+        toccata_reverb_process(self->reverb, outputs[0], outputs[1], num_frames);
+}
+
+/**
+   Free the old synth once a block faded it out. The block may have been
+   rendered by the lookahead thread, but only the audio thread schedules
+   work.
+*/
+static void
+free_old_synth(toccata_plugin_t* self, int num_frames)
+{
+    if (!self->fading_synth || num_frames == 0)
+        return;
+
+    const toccata_work_t work = { .type = WORK_FREE_SYNTH, .synth = self->fading_synth };
+    schedule_work(self, &work);
+    self->fading_synth = NULL;
+}
+
+static void
+reverse_frames(float* buffer, int num_frames)
+{
+    for (int i = 0, j = num_frames - 1; i < j; ++i, --j) {
+        const float frame = buffer[i];
+        buffer[i] = buffer[j];
+        buffer[j] = frame;
+    }
+}
+
+/**
+   Play a block rendered directly, because it is longer than the lookahead,
+   after the frames the lookahead holds. Its last frames take their place,
+   so that the latency stays the same.
+*/
+static void
+play_through_lookahead(toccata_plugin_t* self, int num_frames)
+{
+    toccata_lookahead_t* lookahead = self->lookahead;
+    const int latency = lookahead->latency;
+    for (int channel = 0; channel < NUM_OUTPUT_CHANNELS; ++channel) {
+        if (channel >= 2 && !self->groups_routed[channel / 2 - 1])
+            continue;
+
+        // Swap the held frames with the last ones, then rotate them to the
+        // front of the block
+        float* output = self->output_buffers[channel];
+        float* buffer = lookahead->buffers[channel];
+        for (int i = 0; i < latency; ++i) {
+            const float frame = buffer[i];
+            buffer[i] = output[num_frames - latency + i];
+            output[num_frames - latency + i] = frame;
+        }
+        reverse_frames(output, num_frames);
+        reverse_frames(output, latency);
+        reverse_frames(output + latency, num_frames - latency);
+    }
+}
+
+/**
+   Wait for the block rendered ahead, before anything else uses the synth.
+*/
+static void
+finish_lookahead(toccata_plugin_t* self)
+{
+    if (self->lookahead_frames == 0)
+        return;
+
+    toccata_pool_wait(self->lookahead->pool);
+    free_old_synth(self, self->lookahead_frames);
+    self->lookahead_frames = 0;
+}
+
+/**
+   Once the stops have settled, ask the worker to merge the registration.
+*/
+static void
+request_merge(toccata_plugin_t* self, int num_frames)
+{
+    bool settled = true;
+    for (int stop = 0; stop < TOCCATA_NUM_STOPS; ++stop) {
+        const float gain = toccata_synth_get_stop_gain(self->synth, stop);
+        if (gain != self->settling_gains[stop]) {
+            self->settling_gains[stop] = gain;
+            settled = false;
+        }
+    }
+
+    if (!settled) {
+        self->settled_frames = 0;
+        return;
+    }
+
+    if (self->settled_frames < REGISTRATION_SETTLE_TIME * self->sample_rate) {
+        self->settled_frames += num_frames;
+        return;
+    }
+
+    if (self->merge_pending || !toccata_synth_registration_changed(self->synth))
+        return;
+
+    toccata_work_t work = { .type = WORK_MERGE, .synth = self->synth };
+    memcpy(work.stop_gains, self->settling_gains, sizeof(work.stop_gains));
+    for (int rank = 0; rank < TOCCATA_NUM_RANKS; ++rank)
+        work.rank_outputs[rank] = toccata_synth_get_rank_output(self->synth, rank);
+    if (self->worker->schedule_work(self->worker->handle, sizeof(work), &work) == LV2_WORKER_SUCCESS)
+        self->merge_pending = true;
+}
+
+/**
+   Offline rendering trades CPU for quality: every rank is oversampled at
+   the highest quality, and the registration is not merged, so that each
+   pipe is rendered on its own. The synth crossfades the oversampling in
+   and out from the block boundary. Its output is always delayed as much
+   as the decimator, so the latency port and the timing of exports match
+   the live ones.
+*/
+static void
+apply_profile(toccata_plugin_t* self)
+{
+    const bool freewheeling = self->freewheel_port && *self->freewheel_port > 0.5f;
+    if (freewheeling && !self->freewheeling) {
+        toccata_registration_t* registration = toccata_synth_swap_registration(self->synth, NULL);
+        if (registration) {
+            const toccata_work_t work = { .type = WORK_FREE_REGISTRATION, .registration = registration };
+            schedule_work(self, &work);
+        }
+    }
+    self->freewheeling = freewheeling;
+    toccata_synth_set_oversampling(self->synth, freewheeling ? TOCCATA_MAX_OVERSAMPLING : 1);
+}
+
+static void
+set_thread_pool(toccata_plugin_t* self, int num_threads)
+{
+    toccata_synth_set_thread_pool(self->synth, self->pool, num_threads);
+    if (self->fading_synth)
+        toccata_synth_set_thread_pool(self->fading_synth, self->pool, num_threads);
+}
+
+/**
+   Render on the requested number of threads. The pool only grows, since
+   the threads it does not use sleep.
+*/
+static void
+apply_render_threads(toccata_plugin_t* self)
+{
+    int num_threads = self->render_threads_port ? (int)(*self->render_threads_port + 0.5f) : 1;
+    num_threads = num_threads < self->max_render_threads ? num_threads : self->max_render_threads;
+    num_threads = num_threads > 1 ? num_threads : 1;
+
+    const int pool_threads = self->pool ? toccata_pool_get_num_threads(self->pool) + 1 : 1;
+    if (self->worker && !self->pool_pending && num_threads > pool_threads) {
+        const toccata_work_t work = { .type = WORK_CREATE_POOL, .num_threads = num_threads };
+        if (self->worker->schedule_work(self->worker->handle, sizeof(work), &work) == LV2_WORKER_SUCCESS)
+            self->pool_pending = true;
+    }
+    set_thread_pool(self, num_threads);
+}
+
+/**
+   Start or stop rendering ahead, or start again for a new block size.
+   The output of the current lookahead is dropped when it stops.
+*/
+static void
+apply_lookahead(toccata_plugin_t* self)
+{
+    const bool enabled = self->worker && self->lookahead_port && *self->lookahead_port > 0.5f;
+    if (enabled && !self->lookahead_pending
+        && (!self->lookahead || self->lookahead->latency != self->max_block_size)) {
+        const toccata_work_t work = { .type = WORK_CREATE_LOOKAHEAD, .block_size = self->max_block_size };
+        self->lookahead_pending = true;
+        if (self->worker->schedule_work(self->worker->handle, sizeof(work), &work) != LV2_WORKER_SUCCESS)
+            self->lookahead_pending = false;
+    } else if (!enabled && self->lookahead) {
+        const toccata_work_t work = { .type = WORK_FREE_LOOKAHEAD, .lookahead = self->lookahead };
+        schedule_work(self, &work);
+        self->lookahead = NULL;
+    }
+
+    if (self->latency_port) {
+        const int latency = self->lookahead ? self->lookahead->latency : 0;
+        *self->latency_port = (float)(latency + toccata_synth_get_latency(self->synth));
+    }
+}
+
+/**
+   Send the ranks of each group to its outputs when the host connected
+   them, and to the main outputs otherwise.
+*/
+static void
+apply_routing(toccata_plugin_t* self, int num_frames)
+{
+    for (int group = 0; group < TOCCATA_NUM_GROUPS; ++group) {
+        float** buffers = &self->output_buffers[2 * (group + 1)];
+        const bool routed = buffers[0] && buffers[1];
+        if (routed == self->groups_routed[group])
+            continue;
+
+        self->groups_routed[group] = routed;
+        for (int rank = 0; rank < TOCCATA_NUM_RANKS; ++rank) {
+            if (toccata_ranks[rank].group != group)
+                continue;
+
+            const int output = routed ? group + 1 : 0;
+            toccata_synth_set_rank_output(self->synth, rank, output);
+            if (self->fading_synth)
+                toccata_synth_set_rank_output(self->fading_synth, rank, output);
+        }
+
+        // What the lookahead rendered before belongs to another routing
+        if (routed && self->lookahead) {
+            memset(self->lookahead->buffers[2 * (group + 1)], 0, self->lookahead->latency * sizeof(float));
+            memset(self->lookahead->buffers[2 * (group + 1) + 1], 0, self->lookahead->latency * sizeof(float));
+        }
+    }
+
+    // A lone port of a pair gets silence
+    for (int group = 0; group < TOCCATA_NUM_GROUPS; ++group) {
+        for (int channel = 2 * (group + 1); channel < 2 * (group + 2); ++channel) {
+            if (!self->groups_routed[group] && self->output_buffers[channel])
+                memset(self->output_buffers[channel], 0, num_frames * sizeof(float));
+        }
+    }
+}
+
+static double
+get_time(void)
+{
+#if defined(_WIN32)
+    LARGE_INTEGER counter, frequency;
+    QueryPerformanceCounter(&counter);
+    QueryPerformanceFrequency(&frequency);
+    return (double)counter.QuadPart / (double)frequency.QuadPart;
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + 1e-9 * (double)ts.tv_nsec;
+#endif
+}
+
+static void
+apply_quality(toccata_plugin_t* self)
+{
+    if (self->freewheeling) {
+        for (int rank = 0; rank < TOCCATA_NUM_RANKS; ++rank)
+            toccata_synth_set_rank_quality(self->synth, rank, TOCCATA_QUALITY_CUBIC);
+        return;
+    }
+
+    const int quality = self->quality_port ? (int)(*self->quality_port + 0.5f) : TOCCATA_QUALITY_LINEAR;
+    // Reductions go through the ranks from the last one, one quality level
+    // per pass
+    for (int rank = 0; rank < TOCCATA_NUM_RANKS; ++rank) {
+        const int from_last = TOCCATA_NUM_RANKS - 1 - rank;
+        const int reduction = self->quality_reduction / TOCCATA_NUM_RANKS
+            + (from_last < self->quality_reduction % TOCCATA_NUM_RANKS ? 1 : 0);
+        toccata_synth_set_rank_quality(self->synth, rank, quality - reduction);
     }
 }
 
 static void
-send_cc_if_necessary(toccata_plugin_t* self, const float* port, float* value, int cc)
+update_governor(toccata_plugin_t* self, double elapsed, int sample_count)
 {
-    if (*port != *value) {
-        *value = clamp_gain(*port);
-        sfizz_send_hdcc(self->synth, 0, cc, *value);
+    // Offline, there is no deadline to meet
+    const bool enabled = self->governor_port && *self->governor_port > 0.5f && !self->freewheeling;
+    if (!enabled || sample_count == 0) {
+        self->quality_reduction = 0;
+        self->load = 0.0;
+        self->governor_cooldown = 0;
+        self->governor_calm_frames = 0;
+        return;
+    }
+
+    const double load = elapsed * self->synth_sample_rate / (double)sample_count;
+    self->load += GOVERNOR_LOAD_SMOOTHING * (load - self->load);
+
+    const int quality = self->quality_port ? (int)(*self->quality_port + 0.5f) : TOCCATA_QUALITY_LINEAR;
+    const int max_reduction = quality * TOCCATA_NUM_RANKS;
+    if (self->quality_reduction > max_reduction)
+        self->quality_reduction = max_reduction;
+
+    self->governor_cooldown = self->governor_cooldown > sample_count ? self->governor_cooldown - sample_count : 0;
+    if (self->load > GOVERNOR_HIGH_LOAD) {
+        self->governor_calm_frames = 0;
+        if (self->governor_cooldown == 0 && self->quality_reduction < max_reduction) {
+            self->quality_reduction++;
+            self->governor_cooldown = (int)(GOVERNOR_COOLDOWN_TIME * self->synth_sample_rate);
+        }
+    } else if (self->load < GOVERNOR_LOW_LOAD && self->quality_reduction > 0) {
+        // Quality comes back slowly, so that it does not oscillate around
+        // the limit
+        self->governor_calm_frames += sample_count;
+        if (self->governor_calm_frames >= (int)(GOVERNOR_HOLD_TIME * self->synth_sample_rate)) {
+            self->quality_reduction--;
+            self->governor_calm_frames = 0;
+        }
+    } else {
+        self->governor_calm_frames = 0;
     }
 }
 
+static void
+render_ahead(void* data, int index)
+{
+    (void)index;
+    toccata_plugin_t* self = (toccata_plugin_t*)data;
+    toccata_lookahead_t* lookahead = self->lookahead;
+    const int offset = lookahead->latency - self->lookahead_frames;
+    float* outputs[NUM_OUTPUT_CHANNELS];
+    for (int channel = 0; channel < NUM_OUTPUT_CHANNELS; ++channel)
+        outputs[channel] = lookahead->buffers[channel] + offset;
+
+    const double start_time = get_time();
+    render(self, outputs, self->lookahead_frames);
+    self->lookahead_time = get_time() - start_time;
+}
+
 static void
 run(LV2_Handle instance, uint32_t sample_count)
 {
@@ -426,35 +1144,325 @@ run(LV2_Handle instance, uint32_t sample_count)
     if (!self->input_port)
         return;
 
+    finish_lookahead(self);
+
+    const double start_time = get_time();
+
+    apply_options(self);
+    apply_profile(self);
+    apply_lookahead(self);
+    apply_quality(self);
+    apply_render_threads(self);
+    apply_routing(self, (int)sample_count);
+
+    if (self->stop_smoothing_port)
+        toccata_synth_set_gain_smoothing(self->synth, *self->stop_smoothing_port * 0.001f);
+    if (self->tremulant_rate_port && self->tremulant_depth_port)
+        toccata_synth_set_tremulant(self->synth, *self->tremulant_rate_port, *self->tremulant_depth_port);
+    if (self->wind_model_port)
+        toccata_synth_set_wind_model(self->synth, *self->wind_model_port > 0.5f);
+    if (self->reverb && self->reverb_mix_port)
+        toccata_reverb_set_mix(self->reverb, *self->reverb_mix_port);
+    if (self->reverb && self->reverb_room_port)
+        toccata_reverb_set_room(self->reverb, (int)(*self->reverb_room_port + 0.5f));
+
+    // Port changes go first, so that notes on frame 0 use the new stops
+    for (int stop = 0; stop < TOCCATA_NUM_STOPS; ++stop)
+        send_gain_if_necessary(self, stop);
+    if (self->swell_port && *self->swell_port != self->swell_value) {
+        self->swell_value = *self->swell_port;
+        toccata_synth_set_swell(self->synth, 0, self->swell_value);
+    }
+    if (self->crescendo_port && *self->crescendo_port != self->crescendo_value) {
+        self->crescendo_value = *self->crescendo_port;
+        toccata_synth_set_crescendo(self->synth, 0, self->crescendo_value);
+    }
+
+    // The synth splits the block at the frame of each event
     LV2_ATOM_SEQUENCE_FOREACH(self->input_port, ev)
     {
         // If the received atom is an object/patch message
         if (ev->body.type == self->atom_object_uri) {
             const LV2_Atom_Object* obj = (const LV2_Atom_Object*)&ev->body;
-            lv2_log_warning(&self->logger, "Got an Object atom but it was not supported.\n");
-            if (self->unmap)
+            if (obj->body.otype == self->patch_set_uri) {
+                process_patch_set(self, ev);
+            } else if (self->unmap) {
                 lv2_log_warning(&self->logger,
-                    "Object URI: %s\n",
+                    "Got an unsupported Object atom: %s\n",
                     self->unmap->unmap(self->unmap->handle, obj->body.otype));
-            continue;
+            }
             // Got an atom that is a MIDI event
         } else if (ev->body.type == self->midi_event_uri) {
             process_midi_event(self, ev);
         }
     }
 
-    send_cc_if_necessary(self, self->bourdon16_port, &self->bourdon16_gain, TOCCATA_BOURDON16_CC);
-    send_cc_if_necessary(self, self->flute8_port, &self->flute8_gain, TOCCATA_FLUTE8_CC);
-    send_cc_if_necessary(self, self->montre8_port, &self->montre8_gain, TOCCATA_MONTRE8_CC);
-    send_cc_if_necessary(self, self->flute4_port, &self->flute4_gain, TOCCATA_FLUTE4_CC);
-    send_cc_if_necessary(self, self->prestant4_port, &self->prestant4_gain, TOCCATA_PRESTANT4_CC);
-    send_cc_if_necessary(self, self->doublette2_port, &self->doublette2_gain, TOCCATA_DOUBLETTE2_CC);
-    send_cc_if_necessary(self, self->pleinjeux_port, &self->pleinjeux_gain, TOCCATA_PLEINJEUX_CC);
-    send_cc_if_necessary(self, self->sesquialtera_port, &self->sesquialtera_gain, TOCCATA_SESQUIALTERA_CC);
-    send_cc_if_necessary(self, self->trompette8_port, &self->trompette8_gain, TOCCATA_TROMPETTE8_CC);
+    if (self->watcher) {
+        toccata_watcher_enable(self->watcher, self->hot_reload_port && *self->hot_reload_port > 0.5f);
+        if (toccata_watcher_changed(self->watcher))
+            self->reload_requested = true;
+    }
+
+    if (self->reload_requested && !self->reload_pending) {
+        const toccata_work_t work = {
+            .type = WORK_RELOAD,
+            .sample_rate = self->sample_rate,
+            .block_size = self->max_block_size
+        };
+        if (self->worker->schedule_work(self->worker->handle, sizeof(work), &work) == LV2_WORKER_SUCCESS) {
+            self->reload_requested = false;
+            self->reload_pending = true;
+        }
+    }
+
+    const int num_frames = (int)sample_count;
+    toccata_lookahead_t* lookahead = self->lookahead;
+    if (lookahead && num_frames <= lookahead->latency) {
+        // Play the oldest frames, and render the events of this block after
+        // the others while the host goes on
+        for (int channel = 0; channel < NUM_OUTPUT_CHANNELS; ++channel) {
+            if (channel >= 2 && !self->groups_routed[channel / 2 - 1])
+                continue;
+
+            float* buffer = lookahead->buffers[channel];
+            memcpy(self->output_buffers[channel], buffer, num_frames * sizeof(float));
+            memmove(buffer, buffer + num_frames, (lookahead->latency - num_frames) * sizeof(float));
+        }
+
+        if (self->worker && !self->freewheeling)
+            request_merge(self, num_frames);
+
+        if (num_frames > 0) {
+            self->lookahead_frames = num_frames;
+            toccata_pool_start(lookahead->pool, render_ahead, self, 1);
+        }
+        update_governor(self, get_time() - start_time + self->lookahead_time, num_frames);
+        return;
+    }
+
+    render(self, self->output_buffers, num_frames);
+    free_old_synth(self, num_frames);
+    if (lookahead)
+        play_through_lookahead(self, num_frames);
+
+    if (self->worker && !self->freewheeling)
+        request_merge(self, num_frames);
 
-    check_freewheeling(self);
-    sfizz_render_block(self->synth, self->output_buffers, 2, (int)sample_count);
+    update_governor(self, get_time() - start_time, num_frames);
+}
+
+static LV2_Worker_Status
+work(LV2_Handle instance,
+    LV2_Worker_Respond_Function respond,
+    LV2_Worker_Respond_Handle handle,
+    uint32_t size,
+    const void* data)
+{
+    toccata_plugin_t* self = (toccata_plugin_t*)instance;
+    if (size != sizeof(toccata_work_t))
+        return LV2_WORKER_ERR_UNKNOWN;
+
+    const toccata_work_t* request = (const toccata_work_t*)data;
+    switch (request->type) {
+    case WORK_RELOAD: {
+        toccata_work_t response = *request;
+        response.type = WORK_SWAP_SYNTH;
+        response.synth = create_synth(self, request->sample_rate, request->block_size);
+        if (!response.synth) {
+            lv2_log_error(&self->logger, "Could not reload the instrument, keeping the current one\n");
+        } else {
+            lv2_log_note(&self->logger, "Reloaded the instrument from %s\n", self->instrument_path);
+            // The plugin is running, so the new synth is used right away
+            toccata_synth_lock_memory(response.synth);
+        }
+        // Always respond, so that run() knows the reload is over
+        respond(handle, sizeof(response), &response);
+        break;
+    }
+    case WORK_FREE_SYNTH:
+        toccata_synth_free(request->synth);
+        break;
+    case WORK_RESIZE: {
+        toccata_work_t response = *request;
+        response.type = WORK_SWAP_BUFFERS;
+        response.buffers = toccata_synth_create_buffers(request->block_size, true);
+        if (!response.buffers)
+            lv2_log_error(&self->logger, "Could not allocate buffers for %d frames\n", request->block_size);
+        respond(handle, sizeof(response), &response);
+        break;
+    }
+    case WORK_FREE_BUFFERS:
+        toccata_synth_free_buffers(request->buffers);
+        break;
+    case WORK_MERGE: {
+        // The synth is only freed by this thread, after this request
+        toccata_work_t response = *request;
+        response.type = WORK_SWAP_REGISTRATION;
+        response.registration = toccata_synth_create_registration(request->synth, request->stop_gains,
+            request->rank_outputs, true);
+        if (!response.registration)
+            lv2_log_error(&self->logger, "Could not merge the registration\n");
+        respond(handle, sizeof(response), &response);
+        break;
+    }
+    case WORK_FREE_REGISTRATION:
+        toccata_synth_free_registration(request->registration);
+        break;
+    case WORK_CREATE_POOL: {
+        // The calling thread renders too
+        toccata_work_t response = *request;
+        response.type = WORK_SWAP_POOL;
+        response.pool = toccata_pool_create(request->num_threads - 1);
+        if (!response.pool)
+            lv2_log_error(&self->logger, "Could not start %d render threads\n", request->num_threads - 1);
+        respond(handle, sizeof(response), &response);
+        break;
+    }
+    case WORK_FREE_POOL:
+        toccata_pool_free(request->pool);
+        break;
+    case WORK_CREATE_LOOKAHEAD: {
+        toccata_work_t response = *request;
+        response.type = WORK_SWAP_LOOKAHEAD;
+        response.lookahead = create_lookahead(request->block_size);
+        if (!response.lookahead)
+            lv2_log_error(&self->logger, "Could not start rendering ahead\n");
+        respond(handle, sizeof(response), &response);
+        break;
+    }
+    case WORK_FREE_LOOKAHEAD:
+        free_lookahead(request->lookahead);
+        break;
+    case WORK_CREATE_REVERB: {
+        toccata_work_t response = *request;
+        response.type = WORK_SWAP_REVERB;
+        response.reverb = toccata_reverb_create(self->instrument_path, (float)request->sample_rate,
+            request->block_size);
+        if (!response.reverb)
+            lv2_log_error(&self->logger, "Could not load the rooms of the reverb, keeping the current ones\n");
+        respond(handle, sizeof(response), &response);
+        break;
+    }
+    case WORK_FREE_REVERB:
+        toccata_reverb_free(request->reverb);
+        break;
+    default:
+        return LV2_WORKER_ERR_UNKNOWN;
+    }
+    return LV2_WORKER_SUCCESS;
+}
+
+static LV2_Worker_Status
+work_response(LV2_Handle instance, uint32_t size, const void* data)
+{
+    toccata_plugin_t* self = (toccata_plugin_t*)instance;
+    if (size != sizeof(toccata_work_t))
+        return LV2_WORKER_ERR_UNKNOWN;
+
+    // Responses come between two blocks, maybe while one is rendered ahead
+    finish_lookahead(self);
+
+    const toccata_work_t* response = (const toccata_work_t*)data;
+    switch (response->type) {
+    case WORK_SWAP_SYNTH:
+        self->reload_pending = false;
+        if (!response->synth)
+            break;
+
+        // The sample rate changed while the synth was built, or the
+        // previous swap is still fading: build it again
+        if (response->sample_rate != self->sample_rate || self->fading_synth) {
+            const toccata_work_t work = { .type = WORK_FREE_SYNTH, .synth = response->synth };
+            schedule_work(self, &work);
+            self->reload_requested = true;
+            break;
+        }
+
+        toccata_synth_copy_state(response->synth, self->synth);
+        self->fading_synth = self->synth;
+        self->synth = response->synth;
+        self->synth_block_size = response->block_size;
+        break;
+    case WORK_SWAP_BUFFERS: {
+        self->resize_pending = false;
+        if (!response->buffers)
+            break;
+
+        // Swap even if the size changed again meanwhile, the next run()
+        // will ask for another resize
+        const toccata_work_t work = {
+            .type = WORK_FREE_BUFFERS,
+            .buffers = toccata_synth_swap_buffers(self->synth, response->buffers)
+        };
+        schedule_work(self, &work);
+        self->synth_block_size = response->block_size;
+        break;
+    }
+    case WORK_SWAP_REGISTRATION: {
+        self->merge_pending = false;
+        if (!response->registration)
+            break;
+
+        // A registration merged from a synth that was since reloaded is
+        // stale, and offline rendering does without it
+        toccata_registration_t* registration = response->registration;
+        if (response->synth == self->synth && !self->freewheeling)
+            registration = toccata_synth_swap_registration(self->synth, registration);
+        if (registration) {
+            const toccata_work_t work = { .type = WORK_FREE_REGISTRATION, .registration = registration };
+            schedule_work(self, &work);
+        }
+        break;
+    }
+    case WORK_SWAP_POOL: {
+        self->pool_pending = false;
+        if (!response->pool) {
+            self->max_render_threads = self->pool ? toccata_pool_get_num_threads(self->pool) + 1 : 1;
+            break;
+        }
+
+        // The synths stop using the previous pool before it is freed
+        const toccata_work_t work = { .type = WORK_FREE_POOL, .pool = self->pool };
+        self->pool = response->pool;
+        set_thread_pool(self, response->num_threads);
+        if (work.pool)
+            schedule_work(self, &work);
+        break;
+    }
+    case WORK_SWAP_LOOKAHEAD: {
+        self->lookahead_pending = false;
+        if (!response->lookahead)
+            break;
+
+        // Starts with one block of silence, which the host compensates
+        const toccata_work_t work = { .type = WORK_FREE_LOOKAHEAD, .lookahead = self->lookahead };
+        self->lookahead = response->lookahead;
+        if (work.lookahead)
+            schedule_work(self, &work);
+        break;
+    }
+    case WORK_SWAP_REVERB: {
+        self->reverb_pending = false;
+        if (!response->reverb) {
+            // Do not try again until the options change
+            self->reverb_sample_rate = self->sample_rate;
+            self->reverb_block_size = self->max_block_size;
+            break;
+        }
+
+        // Swap even if the options changed again meanwhile, the next run()
+        // will ask for another reverb. Its tail starts over.
+        const toccata_work_t work = { .type = WORK_FREE_REVERB, .reverb = self->reverb };
+        self->reverb = response->reverb;
+        self->reverb_sample_rate = response->sample_rate;
+        self->reverb_block_size = response->block_size;
+        schedule_work(self, &work);
+        break;
+    }
+    default:
+        return LV2_WORKER_ERR_UNKNOWN;
+    }
+    return LV2_WORKER_SUCCESS;
 }
 
 static uint32_t
@@ -478,15 +1486,22 @@ lv2_set_options(LV2_Handle instance, const LV2_Options_Option* options)
                 lv2_log_warning(&self->logger, "Got a sample rate but the type was wrong\n");
                 continue;
             }
+            // Applied by run() at the next block
             self->sample_rate = *(float*)opt->value;
-            sfizz_set_sample_rate(self->synth, self->sample_rate);
         } else if (opt->key == self->nominal_block_length_uri) {
             if (opt->type != self->atom_int_uri) {
                 lv2_log_warning(&self->logger, "Got a nominal block size but the type was wrong\n");
                 continue;
             }
-            self->max_block_size = *(int*)opt->value;
-            sfizz_set_samples_per_block(self->synth, self->max_block_size);
+            const int block_size = *(int*)opt->value;
+            if (block_size == self->max_block_size)
+                continue;
+            // The worker reallocates the synth buffers after the next run()
+            self->max_block_size = block_size;
+            if (!self->worker)
+                lv2_log_note(&self->logger,
+                    "No worker to resize the synth buffers, rendering in blocks of %d frames\n",
+                    self->synth_block_size);
         }
     }
     return LV2_OPTIONS_SUCCESS;
@@ -496,9 +1511,12 @@ static const void*
 extension_data(const char* uri)
 {
     static const LV2_Options_Interface options = { lv2_get_options, lv2_set_options };
+    static const LV2_Worker_Interface worker = { work, work_response, NULL };
     // Advertise the extensions we support
     if (!strcmp(uri, LV2_OPTIONS__interface))
         return &options;
+    else if (!strcmp(uri, LV2_WORKER__interface))
+        return &worker;
 
     return NULL;
 }
@@ -0,0 +1,421 @@
+/*
+  Toccata LV2 plugin
+
+  Copyright 2020, Paul Ferrand <paul@ferrand.cc>
+
+  Permission to use, copy, modify, and/or distribute this software for any
+  purpose with or without fee is hereby granted, provided that the above
+  copyright notice and this permission notice appear in all copies.
+
+  THIS SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+#include "voicing.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_OPCODES 16
+#define MAX_VOICING_FILE_SIZE (1 << 20)
+
+enum {
+    HEADER_NONE = 0,
+    HEADER_TABLE,
+    HEADER_RANK,
+    HEADER_KEY
+};
+
+typedef struct {
+    const char* name;
+    const char* value;
+    int line;
+} opcode_t;
+
+/**
+   Opcodes are gathered until the next header, since the one naming what
+   the header is about may come after the others.
+*/
+typedef struct {
+    int type;
+    int line;
+    int num_opcodes;
+    opcode_t opcodes[MAX_OPCODES];
+} header_t;
+
+typedef struct {
+    toccata_voicing_t voicing;
+    int rank; ///< Rank of the last `<rank>` header, or -1
+    int error_line;
+} parser_t;
+
+void
+toccata_voicing_init(toccata_voicing_t* voicing)
+{
+    for (int table = 0; table < TOCCATA_TABLES_PER_RANK; ++table)
+        voicing->zones[table] = (toccata_table_zone_t) { .octave = toccata_table_octaves[table], .lokey = -1, .hikey = -1 };
+    for (int rank = 0; rank < TOCCATA_NUM_RANKS; ++rank) {
+        for (int table = 0; table < TOCCATA_TABLES_PER_RANK; ++table)
+            voicing->sustain[rank][table] = 1.0f;
+        for (int k = 0; k < TOCCATA_NUM_KEYS; ++k) {
+            voicing->attack[rank][k] = TOCCATA_DEFAULT_ATTACK_TIME;
+            voicing->decay[rank][k] = 0.0f;
+        }
+    }
+}
+
+static bool
+is_space(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+static bool
+is_digit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+/**
+   Parse a MIDI key number, or a note name with C4 as middle C.
+*/
+static bool
+parse_key(const char* value, int* key)
+{
+    static const int semitones[] = { 9, 11, 0, 2, 4, 5, 7 }; // A to G
+    int result;
+    if (is_digit(*value)) {
+        result = 0;
+        for (; is_digit(*value) && result < 1000; ++value)
+            result = result * 10 + (*value - '0');
+    } else {
+        const char letter = (char)(*value | 0x20);
+        if (letter < 'a' || letter > 'g')
+            return false;
+        result = semitones[letter - 'a'];
+        ++value;
+        if (*value == '#') {
+            result++;
+            ++value;
+        } else if (*value == 'b') {
+            result--;
+            ++value;
+        }
+
+        const bool negative = *value == '-';
+        if (negative)
+            ++value;
+        if (!is_digit(*value) || value[1] != '\0')
+            return false;
+        const int octave = negative ? -(*value - '0') : *value - '0';
+        result += (octave + 1) * 12;
+        ++value;
+    }
+
+    if (*value != '\0' || result < 0 || result > 127)
+        return false;
+    *key = result;
+    return true;
+}
+
+/**
+   Parse a decimal number, whatever the locale says about the separator.
+*/
+static bool
+parse_number(const char* value, float* number)
+{
+    double mantissa = 0.0;
+    double scale = 1.0;
+    int num_digits = 0;
+    const bool negative = *value == '-';
+    if (negative)
+        ++value;
+    for (; is_digit(*value); ++value, ++num_digits)
+        mantissa = mantissa * 10.0 + (*value - '0');
+    if (*value == '.') {
+        for (++value; is_digit(*value); ++value, ++num_digits) {
+            mantissa = mantissa * 10.0 + (*value - '0');
+            scale *= 10.0;
+        }
+    }
+
+    if (*value != '\0' || num_digits == 0 || num_digits > 15)
+        return false;
+    *number = (float)((negative ? -mantissa : mantissa) / scale);
+    return true;
+}
+
+static bool
+parse_time(const char* value, float* time)
+{
+    return parse_number(value, time) && *time >= 0.0f && *time <= 100.0f;
+}
+
+static const opcode_t*
+find_opcode(const header_t* header, const char* name)
+{
+    for (int i = 0; i < header->num_opcodes; ++i) {
+        if (!strcmp(header->opcodes[i].name, name))
+            return &header->opcodes[i];
+    }
+    return NULL;
+}
+
+static bool
+apply_table(parser_t* parser, const header_t* header)
+{
+    const opcode_t* octave = find_opcode(header, "octave");
+    toccata_table_zone_t* zone = NULL;
+    for (int table = 0; octave && table < TOCCATA_TABLES_PER_RANK; ++table) {
+        if (parser->voicing.zones[table].octave == atoi(octave->value))
+            zone = &parser->voicing.zones[table];
+    }
+    if (!zone) {
+        parser->error_line = octave ? octave->line : header->line;
+        return false;
+    }
+
+    for (int i = 0; i < header->num_opcodes; ++i) {
+        const opcode_t* opcode = &header->opcodes[i];
+        int* key = NULL;
+        if (opcode == octave)
+            continue;
+        else if (!strcmp(opcode->name, "lokey"))
+            key = &zone->lokey;
+        else if (!strcmp(opcode->name, "hikey"))
+            key = &zone->hikey;
+        else if (!strcmp(opcode->name, "xfin_lokey"))
+            key = &zone->xfin_lokey;
+        else if (!strcmp(opcode->name, "xfin_hikey"))
+            key = &zone->xfin_hikey;
+        else if (!strcmp(opcode->name, "xfout_lokey"))
+            key = &zone->xfout_lokey;
+        else if (!strcmp(opcode->name, "xfout_hikey"))
+            key = &zone->xfout_hikey;
+
+        if (!key || !parse_key(opcode->value, key)) {
+            parser->error_line = opcode->line;
+            return false;
+        }
+    }
+
+    if (zone->lokey > zone->hikey) {
+        parser->error_line = header->line;
+        return false;
+    }
+    return true;
+}
+
+static bool
+apply_rank(parser_t* parser, const header_t* header)
+{
+    static const char sustain_prefix[] = "ampeg_sustain_c";
+    const opcode_t* name = find_opcode(header, "name");
+    parser->rank = -1;
+    for (int rank = 0; name && rank < TOCCATA_NUM_RANKS; ++rank) {
+        if (!strcmp(toccata_ranks[rank].symbol, name->value))
+            parser->rank = rank;
+    }
+    if (parser->rank < 0) {
+        parser->error_line = name ? name->line : header->line;
+        return false;
+    }
+
+    toccata_voicing_t* voicing = &parser->voicing;
+    const int rank = parser->rank;
+    for (int i = 0; i < header->num_opcodes; ++i) {
+        const opcode_t* opcode = &header->opcodes[i];
+        bool valid = false;
+        float value;
+        if (opcode == name) {
+            valid = true;
+        } else if (!strcmp(opcode->name, "ampeg_attack")) {
+            valid = parse_time(opcode->value, &value);
+            for (int k = 0; valid && k < TOCCATA_NUM_KEYS; ++k)
+                voicing->attack[rank][k] = value;
+        } else if (!strcmp(opcode->name, "ampeg_decay")) {
+            valid = parse_time(opcode->value, &value);
+            for (int k = 0; valid && k < TOCCATA_NUM_KEYS; ++k)
+                voicing->decay[rank][k] = value;
+        } else if (!strncmp(opcode->name, sustain_prefix, sizeof(sustain_prefix) - 1)) {
+            const int octave = atoi(opcode->name + sizeof(sustain_prefix) - 1);
+            for (int table = 0; table < TOCCATA_TABLES_PER_RANK; ++table) {
+                if (voicing->zones[table].octave != octave)
+                    continue;
+                // In percent, as in SFZ
+                valid = parse_number(opcode->value, &value) && value >= 0.0f && value <= 100.0f;
+                if (valid)
+                    voicing->sustain[rank][table] = value / 100.0f;
+            }
+        }
+
+        if (!valid) {
+            parser->error_line = opcode->line;
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool
+apply_key(parser_t* parser, const header_t* header)
+{
+    const opcode_t* key = find_opcode(header, "key");
+    int k = -1;
+    if (key && parse_key(key->value, &k))
+        k -= TOCCATA_LOWEST_KEY;
+    if (parser->rank < 0 || k < 0 || k >= TOCCATA_NUM_KEYS) {
+        parser->error_line = key && parser->rank >= 0 ? key->line : header->line;
+        return false;
+    }
+
+    for (int i = 0; i < header->num_opcodes; ++i) {
+        const opcode_t* opcode = &header->opcodes[i];
+        bool valid = false;
+        if (opcode == key)
+            valid = true;
+        else if (!strcmp(opcode->name, "ampeg_attack"))
+            valid = parse_time(opcode->value, &parser->voicing.attack[parser->rank][k]);
+        else if (!strcmp(opcode->name, "ampeg_decay"))
+            valid = parse_time(opcode->value, &parser->voicing.decay[parser->rank][k]);
+
+        if (!valid) {
+            parser->error_line = opcode->line;
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool
+apply_header(parser_t* parser, const header_t* header)
+{
+    switch (header->type) {
+    case HEADER_TABLE:
+        return apply_table(parser, header);
+    case HEADER_RANK:
+        return apply_rank(parser, header);
+    case HEADER_KEY:
+        return apply_key(parser, header);
+    default:
+        return true;
+    }
+}
+
+static char*
+read_file(const char* path)
+{
+    FILE* file = fopen(path, "rb");
+    if (!file)
+        return NULL;
+
+    fseek(file, 0, SEEK_END);
+    const long file_size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    char* text = file_size >= 0 && file_size < MAX_VOICING_FILE_SIZE ? malloc((size_t)file_size + 1) : NULL;
+    if (text && fread(text, 1, (size_t)file_size, file) == (size_t)file_size) {
+        text[file_size] = '\0';
+    } else {
+        free(text);
+        text = NULL;
+    }
+    fclose(file);
+    return text;
+}
+
+static bool
+parse(parser_t* parser, char* text)
+{
+    header_t header = { .type = HEADER_NONE };
+    char* cursor = text;
+    int line = 1;
+    for (;;) {
+        // Skip blanks and comments
+        while (*cursor) {
+            if (is_space(*cursor))
+                line += *cursor++ == '\n';
+            else if (cursor[0] == '/' && cursor[1] == '/')
+                cursor += strcspn(cursor, "\n");
+            else
+                break;
+        }
+        if (!*cursor)
+            break;
+
+        char* token = cursor;
+        const int token_line = line;
+        while (*cursor && !is_space(*cursor))
+            ++cursor;
+        if (*cursor) {
+            if (*cursor == '\n')
+                ++line;
+            *cursor++ = '\0';
+        }
+
+        if (*token == '<') {
+            if (!apply_header(parser, &header))
+                return false;
+
+            header.line = token_line;
+            header.num_opcodes = 0;
+            if (!strcmp(token, "<table>"))
+                header.type = HEADER_TABLE;
+            else if (!strcmp(token, "<rank>"))
+                header.type = HEADER_RANK;
+            else if (!strcmp(token, "<key>"))
+                header.type = HEADER_KEY;
+            else {
+                parser->error_line = token_line;
+                return false;
+            }
+            continue;
+        }
+
+        char* equals = strchr(token, '=');
+        if (header.type == HEADER_NONE || !equals || equals == token || header.num_opcodes == MAX_OPCODES) {
+            parser->error_line = token_line;
+            return false;
+        }
+        *equals = '\0';
+        header.opcodes[header.num_opcodes++] = (opcode_t) { token, equals + 1, token_line };
+    }
+    return apply_header(parser, &header);
+}
+
+bool
+toccata_voicing_load(toccata_voicing_t* voicing, const char* path, int* error_line)
+{
+    char* text = read_file(path);
+    if (!text) {
+        *error_line = 0;
+        return false;
+    }
+
+    parser_t* parser = (parser_t*)malloc(sizeof(parser_t));
+    if (!parser) {
+        free(text);
+        *error_line = 0;
+        return false;
+    }
+
+    parser->voicing = *voicing;
+    parser->rank = -1;
+    parser->error_line = 0;
+    bool valid = parse(parser, text);
+    for (int table = 0; valid && table < TOCCATA_TABLES_PER_RANK; ++table) {
+        if (parser->voicing.zones[table].lokey < 0 || parser->voicing.zones[table].hikey < 0)
+            valid = false;
+    }
+    if (valid)
+        *voicing = parser->voicing;
+    else
+        *error_line = parser->error_line;
+    free(parser);
+    free(text);
+    return valid;
+}
@@ -0,0 +1,62 @@
+/*
+  Toccata LV2 plugin
+
+  Copyright 2020, Paul Ferrand <paul@ferrand.cc>
+
+  Permission to use, copy, modify, and/or distribute this software for any
+  purpose with or without fee is hereby granted, provided that the above
+  copyright notice and this permission notice appear in all copies.
+
+  THIS SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+#ifndef TOCCATA_VOICING_H
+#define TOCCATA_VOICING_H
+
+#include "organ.h"
+
+#include <stdbool.h>
+
+/// Voicing file of the instrument directory, watched with the tables
+#define TOCCATA_VOICING_FILE "voicing.txt"
+
+/**
+   What the voicers adjust without rebuilding the plugin: the key ranges
+   and crossfades of the tables, and the envelopes of every rank.
+*/
+typedef struct {
+    toccata_table_zone_t zones[TOCCATA_TABLES_PER_RANK];
+    float sustain[TOCCATA_NUM_RANKS][TOCCATA_TABLES_PER_RANK]; ///< From 0 to 1
+    float attack[TOCCATA_NUM_RANKS][TOCCATA_NUM_KEYS]; ///< In seconds
+    float decay[TOCCATA_NUM_RANKS][TOCCATA_NUM_KEYS]; ///< In seconds
+} toccata_voicing_t;
+
+/**
+   What a voicing file leaves out: full sustain, the default attack and
+   no decay. The key ranges of the tables are left unset, since the file
+   has to give them.
+*/
+void toccata_voicing_init(toccata_voicing_t* voicing);
+
+/**
+   Read a voicing file over `voicing`, which keeps what the file leaves
+   out. Returns false if the file is invalid, with `voicing` untouched and
+   the line of the first error in `error_line`, or 0 if the file could not
+   be read or leaves the key range of a table unset.
+
+   The file uses SFZ-like headers and opcodes:
+
+       <table> octave=3 lokey=G2 hikey=B3 xfin_lokey=G2 xfin_hikey=C3
+       <rank> name=montre8 ampeg_sustain_c2=83 ampeg_attack=0.02
+       <key> key=C2 ampeg_attack=0.25 ampeg_decay=0.75
+
+   Keys apply to the rank above them, and rank-wide times to all its keys.
+*/
+bool toccata_voicing_load(toccata_voicing_t* voicing, const char* path, int* error_line);
+
+#endif // TOCCATA_VOICING_H
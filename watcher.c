@@ -0,0 +1,232 @@
+/*
+  Toccata LV2 plugin
+
+  Copyright 2020, Paul Ferrand <paul@ferrand.cc>
+
+  Permission to use, copy, modify, and/or distribute this software for any
+  purpose with or without fee is hereby granted, provided that the above
+  copyright notice and this permission notice appear in all copies.
+
+  THIS SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include "watcher.h"
+#include "voicing.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if !defined(_WIN32) || defined(__MINGW32__)
+#include <dirent.h>
+#include <pthread.h>
+#include <sys/stat.h>
+#include <time.h>
+#define TOCCATA_HAVE_WATCHER 1
+#endif
+
+#define MAX_PATH_SIZE 1024
+#define POLL_INTERVAL_MS 500
+
+#ifdef TOCCATA_HAVE_WATCHER
+
+struct toccata_watcher_t {
+    char* directory;
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t condition;
+    bool running; ///< Protected by `mutex`
+    int enabled; ///< Atomic
+    int changed; ///< Atomic
+};
+
+static uint64_t
+hash_string(const char* string)
+{
+    // FNV-1a
+    uint64_t hash = 14695981039346656037ull;
+    for (; *string; ++string)
+        hash = (hash ^ (uint8_t)*string) * 1099511628211ull;
+    return hash;
+}
+
+static uint64_t
+mix(uint64_t value)
+{
+    value ^= value >> 33;
+    value *= 0xff51afd7ed558ccdull;
+    value ^= value >> 33;
+    return value;
+}
+
+/**
+   The tables and the voicing file make up the instrument. The rooms of the
+   reverb are not rebuilt on reload, so they are left out.
+*/
+static bool
+is_watched(const char* name)
+{
+    const size_t length = strlen(name);
+    if (length >= 4 && !strcmp(name + length - 4, ".wav"))
+        return strncmp(name, "ir_", 3) != 0;
+    return !strcmp(name, TOCCATA_VOICING_FILE);
+}
+
+/**
+   Summarize the names, sizes and modification times of the instrument
+   files. readdir() has no particular order, so the per-file hashes are
+   summed.
+*/
+static uint64_t
+directory_stamp(const char* directory)
+{
+    DIR* dir = opendir(directory);
+    if (!dir)
+        return 0;
+
+    char path[MAX_PATH_SIZE];
+    uint64_t stamp = 0;
+    struct dirent* entry;
+    while ((entry = readdir(dir))) {
+        if (!is_watched(entry->d_name))
+            continue;
+
+        struct stat info;
+        snprintf(path, MAX_PATH_SIZE, "%s%s", directory, entry->d_name);
+        if (stat(path, &info) != 0)
+            continue;
+
+        stamp += mix(hash_string(entry->d_name) ^ mix((uint64_t)info.st_mtime) ^ ((uint64_t)info.st_size << 20));
+    }
+    closedir(dir);
+    return stamp;
+}
+
+static void*
+watch(void* data)
+{
+    toccata_watcher_t* watcher = (toccata_watcher_t*)data;
+    bool polling = false;
+    uint64_t reference = 0;
+    uint64_t previous = 0;
+
+    pthread_mutex_lock(&watcher->mutex);
+    while (watcher->running) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += POLL_INTERVAL_MS * 1000000L;
+        deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+        deadline.tv_nsec %= 1000000000L;
+        pthread_cond_timedwait(&watcher->condition, &watcher->mutex, &deadline);
+        if (!watcher->running)
+            break;
+
+        if (!__atomic_load_n(&watcher->enabled, __ATOMIC_ACQUIRE)) {
+            polling = false;
+            continue;
+        }
+
+        const uint64_t stamp = directory_stamp(watcher->directory);
+        if (!polling) {
+            polling = true;
+            reference = stamp;
+        } else if (stamp != reference && stamp == previous) {
+            // Editors may write a file in several steps, so only report a
+            // change once the directory has been stable for one period.
+            reference = stamp;
+            __atomic_store_n(&watcher->changed, 1, __ATOMIC_RELEASE);
+        }
+        previous = stamp;
+    }
+    pthread_mutex_unlock(&watcher->mutex);
+    return NULL;
+}
+
+toccata_watcher_t*
+toccata_watcher_create(const char* directory)
+{
+    toccata_watcher_t* watcher = (toccata_watcher_t*)calloc(1, sizeof(toccata_watcher_t));
+    if (!watcher)
+        return NULL;
+
+    watcher->directory = strdup(directory);
+    watcher->running = true;
+    pthread_mutex_init(&watcher->mutex, NULL);
+    pthread_cond_init(&watcher->condition, NULL);
+    if (!watcher->directory || pthread_create(&watcher->thread, NULL, watch, watcher) != 0) {
+        pthread_mutex_destroy(&watcher->mutex);
+        pthread_cond_destroy(&watcher->condition);
+        free(watcher->directory);
+        free(watcher);
+        return NULL;
+    }
+    return watcher;
+}
+
+void
+toccata_watcher_free(toccata_watcher_t* watcher)
+{
+    if (!watcher)
+        return;
+
+    pthread_mutex_lock(&watcher->mutex);
+    watcher->running = false;
+    pthread_cond_signal(&watcher->condition);
+    pthread_mutex_unlock(&watcher->mutex);
+    pthread_join(watcher->thread, NULL);
+
+    pthread_mutex_destroy(&watcher->mutex);
+    pthread_cond_destroy(&watcher->condition);
+    free(watcher->directory);
+    free(watcher);
+}
+
+void
+toccata_watcher_enable(toccata_watcher_t* watcher, bool enabled)
+{
+    __atomic_store_n(&watcher->enabled, enabled ? 1 : 0, __ATOMIC_RELEASE);
+}
+
+bool
+toccata_watcher_changed(toccata_watcher_t* watcher)
+{
+    return __atomic_exchange_n(&watcher->changed, 0, __ATOMIC_ACQ_REL) != 0;
+}
+
+#else
+
+toccata_watcher_t*
+toccata_watcher_create(const char* directory)
+{
+    (void)directory;
+    return NULL;
+}
+
+void
+toccata_watcher_free(toccata_watcher_t* watcher)
+{
+    (void)watcher;
+}
+
+void
+toccata_watcher_enable(toccata_watcher_t* watcher, bool enabled)
+{
+    (void)watcher;
+    (void)enabled;
+}
+
+bool
+toccata_watcher_changed(toccata_watcher_t* watcher)
+{
+    (void)watcher;
+    return false;
+}
+
+#endif
@@ -0,0 +1,46 @@
+/*
+  Toccata LV2 plugin
+
+  Copyright 2020, Paul Ferrand <paul@ferrand.cc>
+
+  Permission to use, copy, modify, and/or distribute this software for any
+  purpose with or without fee is hereby granted, provided that the above
+  copyright notice and this permission notice appear in all copies.
+
+  THIS SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#ifndef TOCCATA_WATCHER_H
+#define TOCCATA_WATCHER_H
+
+#include <stdbool.h>
+
+/**
+   Watches the WAV tables and the voicing file of a directory from a
+   background thread, by polling their modification times and sizes while
+   enabled.
+*/
+typedef struct toccata_watcher_t toccata_watcher_t;
+
+toccata_watcher_t* toccata_watcher_create(const char* directory);
+void toccata_watcher_free(toccata_watcher_t* watcher);
+
+/**
+   Start or stop polling. When polling starts, the current state of the
+   directory is taken as the reference. Real-time safe.
+*/
+void toccata_watcher_enable(toccata_watcher_t* watcher, bool enabled);
+
+/**
+   Returns true once for every change to the instrument, after they have
+   stopped changing for one polling period. Real-time safe.
+*/
+bool toccata_watcher_changed(toccata_watcher_t* watcher);
+
+#endif // TOCCATA_WATCHER_H
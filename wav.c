@@ -0,0 +1,132 @@
+/*
+  Toccata LV2 plugin
+
+  Copyright 2020, Paul Ferrand <paul@ferrand.cc>
+
+  Permission to use, copy, modify, and/or distribute this software for any
+  purpose with or without fee is hereby granted, provided that the above
+  copyright notice and this permission notice appear in all copies.
+
+  THIS SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include "wav.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define WAVE_FORMAT_PCM 0x0001
+#define WAVE_FORMAT_IEEE_FLOAT 0x0003
+#define WAVE_FORMAT_EXTENSIBLE 0xFFFE
+
+static uint16_t
+read_u16(const uint8_t* bytes)
+{
+    return (uint16_t)(bytes[0] | (bytes[1] << 8));
+}
+
+static uint32_t
+read_u32(const uint8_t* bytes)
+{
+    return (uint32_t)bytes[0] | ((uint32_t)bytes[1] << 8)
+        | ((uint32_t)bytes[2] << 16) | ((uint32_t)bytes[3] << 24);
+}
+
+static double
+read_sample(const uint8_t* bytes, int format, int bits)
+{
+    if (format == WAVE_FORMAT_IEEE_FLOAT && bits == 32) {
+        const uint32_t raw = read_u32(bytes);
+        float value;
+        memcpy(&value, &raw, sizeof(value));
+        return value;
+    } else if (format == WAVE_FORMAT_IEEE_FLOAT && bits == 64) {
+        const uint64_t raw = read_u32(bytes) | ((uint64_t)read_u32(bytes + 4) << 32);
+        double value;
+        memcpy(&value, &raw, sizeof(value));
+        return value;
+    } else if (bits == 16) {
+        return (int16_t)read_u16(bytes) / 32768.0;
+    } else if (bits == 24) {
+        const uint32_t raw = (uint32_t)bytes[0] << 8 | (uint32_t)bytes[1] << 16 | (uint32_t)bytes[2] << 24;
+        return (int32_t)raw / 2147483648.0;
+    } else {
+        return (int32_t)read_u32(bytes) / 2147483648.0;
+    }
+}
+
+double*
+toccata_wav_read(const char* path, int* num_frames, int* num_channels, float* sample_rate)
+{
+    FILE* file = fopen(path, "rb");
+    if (!file)
+        return NULL;
+
+    fseek(file, 0, SEEK_END);
+    const long file_size = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    uint8_t* bytes = file_size > 12 ? malloc((size_t)file_size) : NULL;
+    const bool read_ok = bytes && fread(bytes, 1, (size_t)file_size, file) == (size_t)file_size;
+    fclose(file);
+
+    if (!read_ok || memcmp(bytes, "RIFF", 4) || memcmp(bytes + 8, "WAVE", 4)) {
+        free(bytes);
+        return NULL;
+    }
+
+    int format = 0;
+    int channels = 0;
+    int bits = 0;
+    uint32_t rate = 0;
+    const uint8_t* data = NULL;
+    uint32_t data_size = 0;
+    for (long offset = 12; offset + 8 <= file_size;) {
+        const uint8_t* chunk = bytes + offset;
+        const uint32_t chunk_size = read_u32(chunk + 4);
+        if ((long)chunk_size > file_size - offset - 8)
+            break;
+
+        if (!memcmp(chunk, "fmt ", 4) && chunk_size >= 16) {
+            format = read_u16(chunk + 8);
+            channels = read_u16(chunk + 10);
+            rate = read_u32(chunk + 12);
+            bits = read_u16(chunk + 22);
+            if (format == WAVE_FORMAT_EXTENSIBLE && chunk_size >= 26)
+                format = read_u16(chunk + 32);
+        } else if (!memcmp(chunk, "data", 4)) {
+            data = chunk + 8;
+            data_size = chunk_size;
+        }
+        offset += 8 + chunk_size + (chunk_size & 1);
+    }
+
+    // A rate of 0 has no meaning, and would divide by zero when resampling
+    const bool supported = channels > 0 && rate > 0
+        && ((format == WAVE_FORMAT_PCM && (bits == 16 || bits == 24 || bits == 32))
+            || (format == WAVE_FORMAT_IEEE_FLOAT && (bits == 32 || bits == 64)));
+    double* samples = NULL;
+    if (supported && data) {
+        const int sample_size = bits / 8;
+        *num_frames = (int)(data_size / (channels * sample_size));
+        const int num_samples = *num_frames * channels;
+        samples = num_samples > 0 ? malloc(num_samples * sizeof(double)) : NULL;
+        for (int i = 0; samples && i < num_samples; ++i)
+            samples[i] = read_sample(data + i * sample_size, format, bits);
+        if (num_channels)
+            *num_channels = channels;
+        if (sample_rate)
+            *sample_rate = (float)rate;
+    }
+
+    free(bytes);
+    return samples;
+}
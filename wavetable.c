@@ -0,0 +1,256 @@
+/*
+  Toccata LV2 plugin
+
+  Copyright 2020, Paul Ferrand <paul@ferrand.cc>
+
+  Permission to use, copy, modify, and/or distribute this software for any
+  purpose with or without fee is hereby granted, provided that the above
+  copyright notice and this permission notice appear in all copies.
+
+  THIS SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#include "wavetable.h"
+#include "fft.h"
+#include "memlock.h"
+#include "wav.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MIN_TABLE_BITS 8
+#define MAX_TABLE_BITS 16
+#define GUARD_POINTS 4
+// Table points per period of the highest harmonic, which keeps the
+// interpolation error of each version well below the harmonic itself.
+#define POINTS_PER_HARMONIC 64
+// Harmonics below -100 dB of the strongest one are dropped
+#define HARMONIC_THRESHOLD 1e-5
+
+static int
+ceil_log2(int value)
+{
+    int bits = 0;
+    while ((1 << bits) < value)
+        ++bits;
+    return bits;
+}
+
+bool
+toccata_wavetable_build(toccata_wavetable_t* table, const double* real, const double* imag,
+    int harmonics, int size_bits)
+{
+    memset(table, 0, sizeof(*table));
+    if (harmonics < 1 || size_bits < MIN_TABLE_BITS || size_bits > MAX_TABLE_BITS
+        || (1 << size_bits) <= 2 * harmonics)
+        return false;
+
+    // The full table first, then one version per octave below it
+    int limits[TOCCATA_MAX_MIPS];
+    int num_mips = 0;
+    limits[num_mips++] = harmonics;
+    int limit = 1;
+    while (limit * 2 < harmonics)
+        limit *= 2;
+    for (; limit >= 1 && limit < harmonics && num_mips < TOCCATA_MAX_MIPS; limit >>= 1)
+        limits[num_mips++] = limit;
+
+    size_t total_points = 0;
+    for (int i = 0; i < num_mips; ++i) {
+        int bits = ceil_log2(limits[i] * POINTS_PER_HARMONIC);
+        bits = bits < MIN_TABLE_BITS ? MIN_TABLE_BITS : bits;
+        bits = bits > size_bits ? size_bits : bits;
+        table->mips[i].size_bits = bits;
+        table->mips[i].harmonics = limits[i];
+        total_points += (1 << bits) + GUARD_POINTS;
+    }
+
+    const int size = 1 << size_bits;
+    double* mip_real = malloc(size * sizeof(double));
+    double* mip_imag = malloc(size * sizeof(double));
+    table->storage_size = total_points * sizeof(float);
+    table->storage = calloc(total_points, sizeof(float));
+    if (!table->storage || !mip_real || !mip_imag) {
+        free(mip_real);
+        free(mip_imag);
+        toccata_wavetable_free(table);
+        return false;
+    }
+
+    float* storage = table->storage;
+    for (int i = 0; i < num_mips; ++i) {
+        toccata_mip_t* mip = &table->mips[i];
+        const int mip_size = 1 << mip->size_bits;
+
+        // Keep the harmonics up to the limit, without the DC offset
+        memset(mip_real, 0, mip_size * sizeof(double));
+        memset(mip_imag, 0, mip_size * sizeof(double));
+        for (int k = 1; k <= mip->harmonics; ++k) {
+            mip_real[k] = real[k] * mip_size;
+            mip_imag[k] = imag[k] * mip_size;
+            mip_real[mip_size - k] = mip_real[k];
+            mip_imag[mip_size - k] = -mip_imag[k];
+        }
+        toccata_fft(mip_real, mip_imag, mip_size, true);
+
+        mip->data = storage + 1;
+        for (int j = 0; j < mip_size; ++j)
+            mip->data[j] = (float)mip_real[j];
+        mip->data[-1] = mip->data[mip_size - 1];
+        mip->data[mip_size] = mip->data[0];
+        mip->data[mip_size + 1] = mip->data[1];
+        mip->data[mip_size + 2] = mip->data[2];
+        storage += mip_size + GUARD_POINTS;
+    }
+    table->num_mips = num_mips;
+
+    free(mip_real);
+    free(mip_imag);
+    return true;
+}
+
+/**
+   Keep the partials of a table that was just built, to combine it with
+   others later on. Frees the table on failure.
+*/
+static bool
+keep_partials(toccata_wavetable_t* table, const double* real, const double* imag, int harmonics)
+{
+    table->partials = calloc(2 * (harmonics + 1), sizeof(float));
+    if (!table->partials) {
+        toccata_wavetable_free(table);
+        return false;
+    }
+
+    table->harmonics = harmonics;
+    for (int k = 1; k <= harmonics; ++k) {
+        table->partials[2 * k] = (float)real[k];
+        table->partials[2 * k + 1] = (float)imag[k];
+    }
+    return true;
+}
+
+bool
+toccata_wavetable_load(toccata_wavetable_t* table, const char* path)
+{
+    memset(table, 0, sizeof(*table));
+
+    int size = 0;
+    int channels = 0;
+    double* real = toccata_wav_read(path, &size, &channels, NULL);
+    if (!real)
+        return false;
+
+    // Single-cycle tables only use their first channel
+    for (int i = 1; i < size; ++i)
+        real[i] = real[i * channels];
+
+    const int size_bits = ceil_log2(size);
+    double* imag = calloc(size, sizeof(double));
+    if ((1 << size_bits) != size || size_bits < MIN_TABLE_BITS || size_bits > MAX_TABLE_BITS || !imag) {
+        free(real);
+        free(imag);
+        return false;
+    }
+
+    // Find the highest significant harmonic of the table
+    toccata_fft(real, imag, size, false);
+    double peak = 0.0;
+    for (int k = 1; k < size / 2; ++k)
+        peak = fmax(peak, hypot(real[k], imag[k]));
+
+    int harmonics = 1;
+    for (int k = 1; k < size / 2; ++k) {
+        if (hypot(real[k], imag[k]) > peak * HARMONIC_THRESHOLD)
+            harmonics = k;
+    }
+
+    for (int k = 0; k <= harmonics; ++k) {
+        real[k] /= size;
+        imag[k] /= size;
+    }
+
+    bool built = toccata_wavetable_build(table, real, imag, harmonics, size_bits);
+    built = built && keep_partials(table, real, imag, harmonics);
+
+    free(real);
+    free(imag);
+    return built;
+}
+
+bool
+toccata_wavetable_blend(toccata_wavetable_t* table, const toccata_wavetable_t* const* sources,
+    const float* weights, int num_sources)
+{
+    memset(table, 0, sizeof(*table));
+
+    int harmonics = 0;
+    int size_bits = 0;
+    for (int i = 0; i < num_sources; ++i) {
+        if (!sources[i]->partials || sources[i]->num_mips == 0)
+            return false;
+        harmonics = sources[i]->harmonics > harmonics ? sources[i]->harmonics : harmonics;
+        size_bits = sources[i]->mips[0].size_bits > size_bits ? sources[i]->mips[0].size_bits : size_bits;
+    }
+
+    double* real = calloc(harmonics + 1, sizeof(double));
+    double* imag = calloc(harmonics + 1, sizeof(double));
+    if (!real || !imag) {
+        free(real);
+        free(imag);
+        return false;
+    }
+
+    for (int i = 0; i < num_sources; ++i) {
+        for (int k = 1; k <= sources[i]->harmonics; ++k) {
+            real[k] += weights[i] * sources[i]->partials[2 * k];
+            imag[k] += weights[i] * sources[i]->partials[2 * k + 1];
+        }
+    }
+
+    bool built = toccata_wavetable_build(table, real, imag, harmonics, size_bits);
+    built = built && keep_partials(table, real, imag, harmonics);
+
+    free(real);
+    free(imag);
+    return built;
+}
+
+void
+toccata_wavetable_free(toccata_wavetable_t* table)
+{
+    toccata_wavetable_unlock(table);
+    free(table->storage);
+    free(table->partials);
+    memset(table, 0, sizeof(*table));
+}
+
+bool
+toccata_wavetable_lock(toccata_wavetable_t* table)
+{
+    return toccata_lock_buffer(table->storage, table->storage_size, &table->locked);
+}
+
+void
+toccata_wavetable_unlock(toccata_wavetable_t* table)
+{
+    toccata_unlock_buffer(table->storage, table->storage_size, &table->locked);
+}
+
+const toccata_mip_t*
+toccata_wavetable_select(const toccata_wavetable_t* table, float frequency, float sample_rate)
+{
+    const float max_harmonic = 0.5f * sample_rate / frequency;
+    for (int i = 0; i < table->num_mips; ++i) {
+        if (table->mips[i].harmonics <= max_harmonic)
+            return &table->mips[i];
+    }
+    return &table->mips[table->num_mips - 1];
+}
@@ -0,0 +1,97 @@
+/*
+  Toccata LV2 plugin
+
+  Copyright 2020, Paul Ferrand <paul@ferrand.cc>
+
+  Permission to use, copy, modify, and/or distribute this software for any
+  purpose with or without fee is hereby granted, provided that the above
+  copyright notice and this permission notice appear in all copies.
+
+  THIS SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+  WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+  MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+  ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+  WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+  ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+  OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+*/
+
+#ifndef TOCCATA_WAVETABLE_H
+#define TOCCATA_WAVETABLE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define TOCCATA_MAX_MIPS 16
+
+/**
+   One band-limited version of a single-cycle table.
+   `data` holds `1 << size_bits` points, preceded by one and followed by
+   three wrap-around guard points so that interpolators can read
+   `data[-1]` to `data[size + 2]` without masking.
+*/
+typedef struct {
+    float* data;
+    int size_bits;
+    int harmonics; ///< Highest harmonic present in this version
+} toccata_mip_t;
+
+/**
+   A single-cycle wavetable with its band-limited versions, from the
+   richest to the poorest. The versions do not depend on the sample rate:
+   the right one is picked when a voice starts.
+*/
+typedef struct {
+    toccata_mip_t mips[TOCCATA_MAX_MIPS];
+    int num_mips;
+    float* storage;
+    size_t storage_size; ///< In bytes
+    float* partials; ///< Real and imaginary parts of harmonics 0 to `harmonics`, if kept
+    int harmonics;
+    bool locked; ///< The storage is locked in memory
+} toccata_wavetable_t;
+
+/**
+   Load a single-cycle table from a WAV file and build its band-limited
+   versions. The file must be mono, or only its first channel is used,
+   and have a power-of-two length. The partials are kept.
+*/
+bool toccata_wavetable_load(toccata_wavetable_t* table, const char* path);
+
+/**
+   Build a table from its harmonics 1 to `harmonics`, given as the forward
+   FFT of one cycle divided by the FFT size. The richest version holds
+   `1 << size_bits` points; the partials are not kept.
+*/
+bool toccata_wavetable_build(toccata_wavetable_t* table, const double* real, const double* imag,
+    int harmonics, int size_bits);
+
+/**
+   Build a table from the partials of `num_sources` tables, each scaled by
+   its weight, with as many points as the largest of them. The sources
+   must have kept their partials; the new table keeps its own.
+*/
+bool toccata_wavetable_blend(toccata_wavetable_t* table, const toccata_wavetable_t* const* sources,
+    const float* weights, int num_sources);
+
+/**
+   Free the table, unlocking its storage if it was locked.
+*/
+void toccata_wavetable_free(toccata_wavetable_t* table);
+
+/**
+   Pre-fault the storage of the table and try to lock it in memory.
+   Returns false if it could only be pre-faulted.
+*/
+bool toccata_wavetable_lock(toccata_wavetable_t* table);
+void toccata_wavetable_unlock(toccata_wavetable_t* table);
+
+/**
+   Pick the richest version of the table that does not alias when played
+   at `frequency`.
+*/
+const toccata_mip_t* toccata_wavetable_select(const toccata_wavetable_t* table,
+    float frequency, float sample_rate);
+
+#endif // TOCCATA_WAVETABLE_H